@@ -6,64 +6,77 @@
 //#include <windows.h>
 //#include <psapi.h>
 #include <stdint.h>
+#include "../peakfinder/mes_peakfinder.h"
+#include "../peakfinder/mes_phasescan.h"
 
-#define MAX_ATTEMPTS 3
 #define MAX_IGNORED 3
-#define NOISE_TOLERANCE 0.9f
-#define PEAK_THRESHOLD 30
 
 static int peakPoint;
 static int sweepCounter = 9300;
 
-typedef struct {
-	float phaseAngle;
-	float impedance;
-} MqsRawDataPoint_t;
-
 int recursionCount = 0; // Counter variable
 
-bool shouldBeIgnored(int index, int ignoreIndices[], int numIgnoreIndices)
+// Scans arr[first..last] for values above *max_val, jumping over the skipped ranges in bulk.
+// 'offset' converts local indices into the combined indices the ranges are expressed in.
+static bool maxInRange(MqsRawDataPoint_t arr[], int first, int last, int offset, MqsInterval_t skipped[], int numSkipped, float *max_val, int *max_row_index)
 {
-    for (int j = 0; j < numIgnoreIndices; j++)
+    bool found = false;
+    int i = first;
+
+    while (i <= last)
     {
-        if (index == ignoreIndices[j])
+        int segmentEnd = last + 1;
+        bool inside = false;
+        for (int j = 0; j < numSkipped; j++)
+        {
+            int left = skipped[j].left - offset;
+            int right = skipped[j].right - offset;
+            if (left <= i && i <= right)
+            {
+                i = right + 1;
+                inside = true;
+                break;
+            }
+            if (left > i && left < segmentEnd)
+            {
+                segmentEnd = left;
+            }
+        }
+
+        if (inside)
+        {
+            continue;
+        }
+
+        for (; i < segmentEnd; i++)
         {
-            return true;
+            if (arr[i].phaseAngle > *max_val)
+            {
+                *max_val = arr[i].phaseAngle;
+                *max_row_index = i;
+                found = true;
+            }
         }
     }
-    return false;
+    return found;
 }
 
-float maxrowCombined(MqsRawDataPoint_t a[], int l1, int r1, MqsRawDataPoint_t b[], int l2, int r2, uint16_t *max_index, int *arrayIndex, int ignoreIndices[], int numIgnoreIndices)
+float maxrowCombined(MqsRawDataPoint_t a[], int l1, int r1, MqsRawDataPoint_t b[], int l2, int r2, int offsetB, MqsIndex_t *max_index, int *arrayIndex, MqsInterval_t skipped[], int numSkipped)
 {
     float max_val = 0.0f;
     int max_row_index = 0;
     *arrayIndex = 0; // Default to array 'a'
 
     // Search in array 'a'
-    for (int i = l1; i <= r1; i++)
+    if (maxInRange(a, l1, r1, 0, skipped, numSkipped, &max_val, &max_row_index))
     {
-        if (shouldBeIgnored(i, ignoreIndices, numIgnoreIndices))
-            continue; // Skip ignored indices
-        if (a[i].phaseAngle > max_val)
-        {
-            max_val = a[i].phaseAngle;
-            max_row_index = i;
-            *arrayIndex = 1; // Found in array 'a'
-        }
+        *arrayIndex = 1; // Found in array 'a'
     }
 
-    // Search in array 'b'
-    for (int i = l2; i <= r2; i++)
+    // Search in array 'b', whose combined indices start at offsetB
+    if (maxInRange(b, l2, r2, offsetB, skipped, numSkipped, &max_val, &max_row_index))
     {
-        if (shouldBeIgnored(i + r1, ignoreIndices, numIgnoreIndices))
-            continue; // Adjust index and skip if needed
-        if (b[i].phaseAngle > max_val)
-        {
-            max_val = b[i].phaseAngle;
-            max_row_index = i;
-            *arrayIndex = 2; // Found in array 'b'
-        }
+        *arrayIndex = 2; // Found in array 'b'
     }
 
     *max_index = max_row_index;
@@ -71,7 +84,7 @@ float maxrowCombined(MqsRawDataPoint_t a[], int l1, int r1, MqsRawDataPoint_t b[
 }
 
 
-static float findPeakrec(MqsRawDataPoint_t a[], int l1, int r1, MqsRawDataPoint_t b[], int l2, int r2, uint16_t *peakIndex, int *arrayIndex, int ignoreIndices[], int numIgnoreIndices)
+static float findPeakrec(MqsRawDataPoint_t a[], int l1, int r1, MqsRawDataPoint_t b[], int l2, int r2, int offsetB, MqsIndex_t *peakIndex, int *arrayIndex, MqsInterval_t skipped[], int numSkipped)
 {
     // Base case for recursion
     if (l1 > r1 && l2 > r2)
@@ -79,7 +92,7 @@ static float findPeakrec(MqsRawDataPoint_t a[], int l1, int r1, MqsRawDataPoint_
         return -1; // No peak found
     }
 
-    float max_val = maxrowCombined(a, l1, r1, b, l2, r2, peakIndex, arrayIndex, ignoreIndices, numIgnoreIndices);
+    float max_val = maxrowCombined(a, l1, r1, b, l2, r2, offsetB, peakIndex, arrayIndex, skipped, numSkipped);
 
     int mid_combined_a = l1 + (r1 - l1) / 2;
     int mid_combined_b = l2 + (r2 - l2) / 2;
@@ -87,12 +100,12 @@ static float findPeakrec(MqsRawDataPoint_t a[], int l1, int r1, MqsRawDataPoint_
     // Check if the peak is in array 'a'
     if (*arrayIndex == 1 && mid_combined_a > l1 && max_val < a[mid_combined_a - 1].phaseAngle)
     {
-        return findPeakrec(a, l1, mid_combined_a - 1, b, l2, r2, peakIndex, arrayIndex, ignoreIndices, numIgnoreIndices);
+        return findPeakrec(a, l1, mid_combined_a - 1, b, l2, r2, offsetB, peakIndex, arrayIndex, skipped, numSkipped);
     }
     // Check if the peak is in array 'b'
     else if (*arrayIndex == 2 && mid_combined_b > l2 && max_val < b[mid_combined_b - 1].phaseAngle)
     {
-        return findPeakrec(a, l1, r1, b, l2, mid_combined_b - 1, peakIndex, arrayIndex, ignoreIndices, numIgnoreIndices);
+        return findPeakrec(a, l1, r1, b, l2, mid_combined_b - 1, offsetB, peakIndex, arrayIndex, skipped, numSkipped);
     }
     else
     {
@@ -166,6 +179,11 @@ static float calculateProminenceForCombinedArrays(MqsRawDataPoint_t a[], MqsRawD
     return prominence;
 }
 
+static float combinedPhase(MqsRawDataPoint_t a[], MqsRawDataPoint_t b[], int totalSizeA, int index)
+{
+    return (index < totalSizeA) ? a[index].phaseAngle : b[index - totalSizeA].phaseAngle;
+}
+
 void calculateSecondOrderDifferenceForCombinedArrays(MqsRawDataPoint_t a[], MqsRawDataPoint_t b[], float secondOrderDiff[], int totalSizeA, int totalSizeB) {
     for (int i = 1; i < totalSizeA + totalSizeB - 1; ++i) {
         float valueA, valueB, valueC;
@@ -186,7 +204,7 @@ void calculateSecondOrderDifferenceForCombinedArrays(MqsRawDataPoint_t a[], MqsR
 }
 
 // Function to find the FWHM peak for combined arrays
-static int calculateFWHMForCombinedArrays(MqsRawDataPoint_t a[], MqsRawDataPoint_t b[], int totalSizeA, int totalSizeB, int arrayIndex, int peakIndex, float prominence)
+static int calculateFWHMForCombinedArrays(MqsRawDataPoint_t a[], MqsRawDataPoint_t b[], int totalSizeA, int totalSizeB, int arrayIndex, int peakIndex, float prominence, MqsInterval_t *crossingIndices)
 {
     // Calculate the base of the prominence, which is the peak height minus the prominence
     float peakHeight = (arrayIndex == 1) ? a[peakIndex].phaseAngle : b[peakIndex - totalSizeA].phaseAngle;
@@ -195,22 +213,48 @@ static int calculateFWHMForCombinedArrays(MqsRawDataPoint_t a[], MqsRawDataPoint
     // The height at which we measure the FWHM is half the prominence above the contour line
     float halfProminenceHeight = contourLineHeight + (prominence / 2.0f);
 
-    // Initialize left and right indices
-    int leftIndex = peakIndex;
-    int rightIndex = peakIndex;
+    int totalSize = totalSizeA + totalSizeB;
 
-    // Iterate through the left side of the peak to find the index where it crosses the half prominence height
-    while (leftIndex > 0 && ((arrayIndex == 1 && leftIndex < totalSizeA) ? a[leftIndex].phaseAngle : b[leftIndex - totalSizeA].phaseAngle) > halfProminenceHeight)
+    // Search for the left crossing, first through the part of 'b' left of the peak, then
+    // through 'a'. Splitting the range per array keeps the segment test out of the inner loop.
+    int leftIndex = -1;
+    if (peakIndex >= totalSizeA)
     {
-        leftIndex--;
+        int first = peakIndex - totalSizeA;
+        int found = scanPhaseLeft(b, first, 0, halfProminenceHeight, PHASE_AT_OR_BELOW);
+        leftIndex = (found >= 0) ? found + totalSizeA : -1;
+    }
+    if (leftIndex < 0)
+    {
+        int first = (peakIndex < totalSizeA) ? peakIndex : totalSizeA - 1;
+        leftIndex = scanPhaseLeft(a, first, 1, halfProminenceHeight, PHASE_AT_OR_BELOW);
+    }
+    if (leftIndex < 0)
+    {
+        leftIndex = 0;
     }
-    // Adjust index if we are in the second array
 
-    // Iterate through the right side of the peak to find the index where it crosses the half prominence height
-    while (rightIndex < totalSizeA + totalSizeB - 1 && ((rightIndex < totalSizeA) ? a[rightIndex].phaseAngle : b[rightIndex - totalSizeA].phaseAngle) > halfProminenceHeight)
+    // Search for the right crossing, first through the part of 'a' right of the peak, then
+    // through 'b'
+    int rightIndex = -1;
+    if (peakIndex < totalSizeA)
+    {
+        int last = (totalSizeA - 1 < totalSize - 2) ? totalSizeA - 1 : totalSize - 2;
+        rightIndex = scanPhaseRight(a, peakIndex, last, halfProminenceHeight, PHASE_AT_OR_BELOW);
+    }
+    if (rightIndex < 0)
     {
-        rightIndex++;
+        int first = (peakIndex >= totalSizeA) ? peakIndex - totalSizeA : 0;
+        int found = scanPhaseRight(b, first, totalSizeB - 2, halfProminenceHeight, PHASE_AT_OR_BELOW);
+        rightIndex = (found >= 0) ? found + totalSizeA : -1;
     }
+    if (rightIndex < 0)
+    {
+        rightIndex = totalSize - 1;
+    }
+
+    crossingIndices->left = leftIndex;
+    crossingIndices->right = rightIndex;
 
     // Calculate FWHM by subtracting indices, considering the contiguous nature of arrays a and b
     int fwhm = fabs(rightIndex - leftIndex);
@@ -218,6 +262,23 @@ static int calculateFWHMForCombinedArrays(MqsRawDataPoint_t a[], MqsRawDataPoint
     return fwhm;
 }
 
+// Extent of a rejected peak: from the half-height crossings, follow each flank outward while
+// the signal keeps descending, down to the base of the peak on that side
+static MqsInterval_t findPeakExtentForCombinedArrays(MqsRawDataPoint_t a[], MqsRawDataPoint_t b[], int totalSizeA, int totalSizeB, MqsInterval_t crossingIndices)
+{
+    MqsInterval_t extent = crossingIndices;
+
+    while (extent.left > 0 && combinedPhase(a, b, totalSizeA, extent.left - 1) <= combinedPhase(a, b, totalSizeA, extent.left))
+    {
+        extent.left--;
+    }
+    while (extent.right < totalSizeA + totalSizeB - 1 && combinedPhase(a, b, totalSizeA, extent.right + 1) <= combinedPhase(a, b, totalSizeA, extent.right))
+    {
+        extent.right++;
+    }
+    return extent;
+}
+
 static bool isPeakClimbing(MqsRawDataPoint_t b[], int sizeB, int peakIndex, float noiseTolerance)
 {
     if (peakIndex <= 0 || peakIndex >= sizeB - 1)
@@ -246,29 +307,39 @@ static bool isPeakClimbing(MqsRawDataPoint_t b[], int sizeB, int peakIndex, floa
     return failCount < 2; 
 }
 
-bool processOverlapPeak(MqsRawDataPoint_t *rawData1, int size1, MqsRawDataPoint_t *rawData2, int size2, int maxUpdateAttempts, uint16_t *peakPoint, bool* isEdgeCase)
+bool processOverlapPeak(MqsRawDataPoint_t *rawData1, int size1, MqsRawDataPoint_t *rawData2, int size2, int maxUpdateAttempts, MqsIndex_t *peakPoint, bool* isEdgeCase)
 {
     int peakUpdateAttempts = 0;
     int fwhm = 0;
-    uint16_t peakIndex = 0;
+    MqsIndex_t peakIndex = 0;
     int arrayIndex = -1;
     float peakValue = 0.0f;
 
-    int ignoredIndices[MAX_IGNORED]; // Array to store indices of ignored peaks
-    int numIgnored = 0;              // Number of ignored indices
+    MqsInterval_t ignoredRanges[MAX_IGNORED]; // Extents of the ignored combined index ranges
+    int numIgnored = 0;                       // Number of ignored ranges
+
+#ifdef MES_INDEX_16BIT
+    // Combined indices run up to size1 + size2 - 1 and must fit MqsIndex_t
+    if (size1 + size2 - 1 > MES_INDEX_MAX)
+    {
+        printf("Combined sweep too long for 16-bit indices.\n");
+        return false;
+    }
+#endif
 
     do
     {
-        peakValue = findPeakrec(rawData1, 0, size1 - 1, rawData2, 0, size2 - 1, &peakIndex, &arrayIndex, ignoredIndices, numIgnored);
+        peakValue = findPeakrec(rawData1, 0, size1 - 1, rawData2, 0, size2 - 1, size1, &peakIndex, &arrayIndex, ignoredRanges, numIgnored);
 
         peakIndex = (arrayIndex == 1) ? peakIndex : peakIndex + size1;
 
         // Calculate prominence
         float prominence = calculateProminenceForCombinedArrays(rawData1, rawData2, size1 - 1, size2 - 1, arrayIndex, peakIndex);
         printf("Peak: %f\n", peakValue);
-        printf("Index: %d\n", peakIndex);
+        printf("Index: %lu\n", (unsigned long)peakIndex);
         printf("p: %f\n", prominence);
-        if (prominence > 18.0f)
+
+        if (prominence > MIN_PEAK_PROMINENCE)
         {
             int localPeakIndex = arrayIndex == 2 ? peakIndex - size1 : peakIndex;
             // printf("localPeakIndex %d\n", localPeakIndex);
@@ -278,9 +349,10 @@ bool processOverlapPeak(MqsRawDataPoint_t *rawData1, int size1, MqsRawDataPoint_
                 *isEdgeCase = isPeakClimbing(rawData2, size2, localPeakIndex, NOISE_TOLERANCE);
             }
 
-            fwhm = calculateFWHMForCombinedArrays(rawData1, rawData2, size1, size2, arrayIndex, peakIndex, prominence);
+            MqsInterval_t crossingIndices;
+            fwhm = calculateFWHMForCombinedArrays(rawData1, rawData2, size1, size2, arrayIndex, peakIndex, prominence, &crossingIndices);
             printf("FWHM: %d\n", fwhm);
-            if (fwhm > 15)
+            if (fwhm > MIN_PEAK_FWHM)
             {
                 *peakPoint = peakIndex;
                 return true;
@@ -289,10 +361,10 @@ bool processOverlapPeak(MqsRawDataPoint_t *rawData1, int size1, MqsRawDataPoint_
             {
                 printf("FWHM is less than 15.0.\n");
 
-                // Add this peak index to ignored indices
+                // Exclude the whole extent of this peak from the next searches
                 if (numIgnored < MAX_IGNORED)
                 {
-                    ignoredIndices[numIgnored++] = peakIndex;
+                    ignoredRanges[numIgnored++] = findPeakExtentForCombinedArrays(rawData1, rawData2, size1, size2, crossingIndices);
                 }
 
                 peakUpdateAttempts++;
@@ -313,9 +385,9 @@ bool processOverlapPeak(MqsRawDataPoint_t *rawData1, int size1, MqsRawDataPoint_
 }
 
 uint8_t mes_find_overlap_peak(MqsRawDataPoint_t* rawData1, int size1, MqsRawDataPoint_t* rawData2, int size2, int* sweepCounter) {
-    uint16_t peakIndex = 0;
+    MqsIndex_t peakIndex = 0;
     bool isPeakStillClimaxing = false;
-    int maxUpdateAttempts = MAX_ATTEMPTS;
+    int maxUpdateAttempts = MAX_PEAK_ATTEMPTS;
 
     //should return false if isPeakStillClimaxing is true.
     bool peakAccepted = processOverlapPeak(rawData1, size1, rawData2, size2, maxUpdateAttempts, &peakIndex, &isPeakStillClimaxing);
@@ -0,0 +1,178 @@
+/*!
+ * Baseline Estimation
+ *
+ * Description:
+ * Fits a low-order polynomial to the drift of a sweep by asymmetric iteratively reweighted
+ * least squares: samples above the current baseline, which belong to peaks, get a small
+ * weight, so the polynomial follows the lower envelope of the sweep. The fit is cached per
+ * channel and only refined every few sweeps, since the drift changes slowly. The detector
+ * subtracts it from each sample as it reads it, so no detrended copy is written.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+#include <stdbool.h>
+#include "mes_baseline.h"
+#include "mes_noalloc.h"
+
+/*!
+ * @brief Solves the (n x n) system m x = v in place by Gaussian elimination with partial pivoting.
+ *
+ * @return False if the system is singular.
+ */
+static bool solveNormalEquations(double m[][MES_BASELINE_MAX_DEGREE + 1], double v[], int n)
+{
+    for (int col = 0; col < n; col++)
+    {
+        int pivot = col;
+        for (int row = col + 1; row < n; row++)
+        {
+            if (fabs(m[row][col]) > fabs(m[pivot][col]))
+            {
+                pivot = row;
+            }
+        }
+        if (fabs(m[pivot][col]) < 1e-12)
+        {
+            return false;
+        }
+        for (int k = 0; k < n; k++)
+        {
+            double tmp = m[col][k];
+            m[col][k] = m[pivot][k];
+            m[pivot][k] = tmp;
+        }
+        double tmp = v[col];
+        v[col] = v[pivot];
+        v[pivot] = tmp;
+
+        for (int row = col + 1; row < n; row++)
+        {
+            double factor = m[row][col] / m[col][col];
+            for (int k = col; k < n; k++)
+            {
+                m[row][k] -= factor * m[col][k];
+            }
+            v[row] -= factor * v[col];
+        }
+    }
+    for (int row = n - 1; row >= 0; row--)
+    {
+        for (int k = row + 1; k < n; k++)
+        {
+            v[row] -= m[row][k] * v[k];
+        }
+        v[row] /= m[row][row];
+    }
+    return true;
+}
+
+void baselineInit(MqsBaseline_t *baseline, int degree, int refreshInterval)
+{
+    *baseline = (MqsBaseline_t){ 0 };
+    baseline->degree = (degree < 0) ? 0 : (degree > MES_BASELINE_MAX_DEGREE) ? MES_BASELINE_MAX_DEGREE : degree;
+    baseline->refreshInterval = (refreshInterval < 1) ? 1 : refreshInterval;
+}
+
+float baselineAt(const MqsBaseline_t *baseline, int i)
+{
+    float t = (float)i * baseline->scale - 1.0f;
+    float value = 0.0f;
+
+    for (int k = baseline->degree; k >= 0; k--)
+    {
+        value = value * t + baseline->coefficients[k];
+    }
+    return value;
+}
+
+bool baselineFit(MqsBaseline_t *baseline, const MqsRawDataPoint_t a[], int size)
+{
+    int n = baseline->degree + 1;
+    if (size < n || size < 2)
+    {
+        return false;
+    }
+
+    // A cached fit of the same sweep length is only refined, starting from its weights
+    bool warm = baseline->valid && baseline->size == size;
+    int iterations = warm ? BASELINE_REFINE_ITERATIONS : BASELINE_ITERATIONS;
+    float scale = 2.0f / (float)(size - 1);
+
+    baseline->size = size;
+    baseline->scale = scale;
+
+    float coefficients[MES_BASELINE_MAX_DEGREE + 1];
+    for (int k = 0; k < n; k++)
+    {
+        coefficients[k] = baseline->coefficients[k];
+    }
+
+    for (int iteration = 0; iteration < iterations; iteration++)
+    {
+        bool weighted = warm || iteration > 0; // The first fit from scratch is ordinary least squares
+        double moments[2 * MES_BASELINE_MAX_DEGREE + 1] = { 0 };
+        double v[MES_BASELINE_MAX_DEGREE + 1] = { 0 };
+        double m[MES_BASELINE_MAX_DEGREE + 1][MES_BASELINE_MAX_DEGREE + 1];
+
+        for (int i = 0; i < size; i++)
+        {
+            float t = (float)i * scale - 1.0f;
+            float y = a[i].phaseAngle;
+            float fit = 0.0f;
+            for (int k = n - 1; k >= 0; k--)
+            {
+                fit = fit * t + coefficients[k];
+            }
+            float w = (weighted && y > fit) ? BASELINE_ASYMMETRY : 1.0f;
+
+            // Weighted powers of t up to 2 * degree for the matrix, up to degree for the vector
+            float power = w;
+            for (int k = 0; k < 2 * n - 1; k++)
+            {
+                moments[k] += power;
+                power *= t;
+            }
+            power = w * y;
+            for (int k = 0; k < n; k++)
+            {
+                v[k] += power;
+                power *= t;
+            }
+        }
+
+        for (int row = 0; row < n; row++)
+        {
+            for (int col = 0; col < n; col++)
+            {
+                m[row][col] = moments[row + col];
+            }
+        }
+        if (!solveNormalEquations(m, v, n))
+        {
+            baseline->valid = false;
+            return false;
+        }
+        for (int k = 0; k < n; k++)
+        {
+            coefficients[k] = (float)v[k];
+            baseline->coefficients[k] = coefficients[k];
+        }
+        baseline->valid = true;
+    }
+
+    baseline->age = 0;
+    return true;
+}
+
+bool baselineUpdate(MqsBaseline_t *baseline, const MqsRawDataPoint_t a[], int size)
+{
+    if (!baseline->valid || baseline->size != size || baseline->age + 1 >= baseline->refreshInterval)
+    {
+        return baselineFit(baseline, a, size);
+    }
+    baseline->age++;
+    return true;
+}
@@ -0,0 +1,420 @@
+/*!
+ * Batch Peak Finding
+ *
+ * Description:
+ * Vertical (lane-parallel) variant of the peak finding algorithm. Sweeps are short, so
+ * instead of vectorising the scan of a single sweep, up to MES_BATCH_LANES equal-length
+ * sweeps are transposed into a lane-interleaved layout and analysed together: sample i of
+ * every sweep sits in one contiguous row, and every stage walks the rows once while each
+ * lane keeps its own state. The inner per-lane loops are branch free: conditions are integer
+ * masks combined with '&' and '|', and every update is a select between computed values, so
+ * the compiler maps a row onto one vector register. Per-lane state is kept in plain arrays
+ * (one array per field) rather than in structures, so it is read with contiguous loads.
+ * The lane loops carry '#pragma GCC unroll 1': a trip count of LANES would otherwise be fully
+ * unrolled first, turning the lane state into scalars the loop vectoriser can no longer map.
+ *
+ * The acceptance rules are those of processPeak: global argmax outside the skipped ranges,
+ * prominence against the nearest higher samples, FWHM at half prominence, up to
+ * MAX_PEAK_ATTEMPTS retries for narrow peaks and the climbing check near the sweep end.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <stdbool.h>
+#include "mes_peakfinder.h"
+#include "mes_workspace.h"
+#include "mes_noalloc.h"
+
+#define LANES MES_BATCH_LANES
+
+/*!
+ * @brief Transposes equal-length sweeps into the lane-interleaved batch layout.
+ *
+ * @param sweeps Array of numSweeps pointers to raw data arrays.
+ * @param numSweeps Number of sweeps, at most MES_BATCH_LANES.
+ * @param size The size of every sweep.
+ * @param interleaved Output buffer of size * MES_BATCH_LANES floats.
+ */
+void transposeSweepBatch(MqsRawDataPoint_t* sweeps[], int numSweeps, int size, float interleaved[])
+{
+    if (numSweeps > LANES)
+    {
+        numSweeps = LANES;
+    }
+
+    memset(interleaved, 0, sizeof(float) * LANES * size);
+
+    for (int l = 0; l < numSweeps; l++)
+    {
+        for (int i = 0; i < size; i++)
+        {
+            interleaved[i * LANES + l] = sweeps[l][i].phaseAngle;
+        }
+    }
+}
+
+/*!
+ * @brief Finds the maximum of every lane, ignoring the skipped ranges of that lane.
+ *
+ * Mirrors maxrow: the running maximum starts at 0 with index 0 and only strictly greater
+ * samples replace it.
+ *
+ * @param x Lane-interleaved data.
+ * @param size The size of every sweep.
+ * @param skipped Per-lane skipped ranges, MAX_PEAK_ATTEMPTS entries per lane (empty if unused).
+ * @param maxVal Output, maximum value per lane.
+ * @param maxIndex Output, index of the maximum per lane.
+ */
+static void maxrowBatch(const float x[], int size, const MqsInterval_t skipped[][MAX_PEAK_ATTEMPTS], float maxVal[], int maxIndex[])
+{
+    int skipLeft[MAX_PEAK_ATTEMPTS][LANES];
+    int skipRight[MAX_PEAK_ATTEMPTS][LANES];
+    float best[LANES];
+    int bestIndex[LANES];
+
+    for (int l = 0; l < LANES; l++)
+    {
+        best[l] = 0.0f;
+        bestIndex[l] = 0;
+        for (int k = 0; k < MAX_PEAK_ATTEMPTS; k++)
+        {
+            skipLeft[k][l] = skipped[l][k].left;
+            skipRight[k][l] = skipped[l][k].right;
+        }
+    }
+
+    for (int i = 0; i < size; i++)
+    {
+        const float *row = &x[i * LANES];
+#pragma GCC unroll 1
+        for (int l = 0; l < LANES; l++)
+        {
+            int ignore = 0;
+            for (int k = 0; k < MAX_PEAK_ATTEMPTS; k++)
+            {
+                ignore |= (skipLeft[k][l] <= i) & (i <= skipRight[k][l]);
+            }
+
+            int greater = (ignore ^ 1) & (row[l] > best[l]);
+            best[l] = greater ? row[l] : best[l];
+            bestIndex[l] = greater ? i : bestIndex[l];
+        }
+    }
+
+    for (int l = 0; l < LANES; l++)
+    {
+        maxVal[l] = best[l];
+        maxIndex[l] = bestIndex[l];
+    }
+}
+
+/*!
+ * @brief Calculates the prominence of the peak of every lane in one forward pass.
+ *
+ * Equivalent to findProminence: the minimum between the nearest higher samples on either
+ * side of the peak (or the ends of the search range). On the left, a running minimum is
+ * restarted at every higher sample, so the value held when the peak is reached covers
+ * exactly [leftBoundary, peakIndex]. On the right, the minimum is accumulated until the
+ * first higher sample has been included.
+ *
+ * @param x Lane-interleaved data.
+ * @param size The size of the search range.
+ * @param peakIndex Peak index per lane.
+ * @param prominence Output, prominence per lane.
+ * @param boundaries Output, nearest higher samples (or ends) on both sides per lane.
+ */
+static void findProminenceBatch(const float x[], int size, const int peakIndex[], float prominence[], MqsInterval_t boundaries[])
+{
+    int peak[LANES];
+    float peakVal[LANES];
+    float leftMin[LANES];
+    float rightMin[LANES];
+    int rightOpen[LANES];
+    int leftBoundary[LANES];
+    int rightBoundary[LANES];
+
+    for (int l = 0; l < LANES; l++)
+    {
+        peak[l] = peakIndex[l];
+        peakVal[l] = x[peakIndex[l] * LANES + l];
+        leftMin[l] = INFINITY;
+        rightMin[l] = INFINITY;
+        rightOpen[l] = 1;
+        leftBoundary[l] = 0;
+        rightBoundary[l] = size - 1;
+    }
+
+    for (int i = 0; i < size; i++)
+    {
+        const float *row = &x[i * LANES];
+#pragma GCC unroll 1
+        for (int l = 0; l < LANES; l++)
+        {
+            float v = row[l];
+            int higher = v > peakVal[l];
+
+            // Left side: restart at every higher sample before the peak
+            int left = i <= peak[l];
+            int restart = left & (higher | (v < leftMin[l]));
+            leftMin[l] = restart ? v : leftMin[l];
+            leftBoundary[l] = (left & higher) ? i : leftBoundary[l];
+
+            // Right side: accumulate up to and including the first higher sample
+            int right = (i >= peak[l]) & rightOpen[l];
+            rightMin[l] = (right & (v < rightMin[l])) ? v : rightMin[l];
+            rightBoundary[l] = (right & higher) ? i : rightBoundary[l];
+            rightOpen[l] = (right & higher) ? 0 : rightOpen[l];
+        }
+    }
+
+    for (int l = 0; l < LANES; l++)
+    {
+        prominence[l] = peakVal[l] - fminf(leftMin[l], rightMin[l]);
+        boundaries[l].left = leftBoundary[l];
+        boundaries[l].right = rightBoundary[l];
+    }
+}
+
+/*!
+ * @brief Calculates the FWHM of the peak of every lane in one forward pass.
+ *
+ * Equivalent to calculateFWHM: the left crossing is the last sample at or below the
+ * half-prominence height before the peak (0 if none), the right crossing the first one
+ * after it (size - 1 if none).
+ *
+ * @param x Lane-interleaved data.
+ * @param size The size of every sweep.
+ * @param peakIndex Peak index per lane.
+ * @param prominence Prominence per lane.
+ * @param fwhm Output, FWHM per lane.
+ * @param crossingIndices Output, sample indices of both crossings per lane.
+ */
+static void calculateFWHMBatch(const float x[], int size, const int peakIndex[], const float prominence[], int fwhm[], MqsInterval_t crossingIndices[])
+{
+    int peak[LANES];
+    float halfHeight[LANES];
+    int leftIndex[LANES];
+    int rightIndex[LANES];
+    int rightOpen[LANES];
+
+    for (int l = 0; l < LANES; l++)
+    {
+        peak[l] = peakIndex[l];
+        halfHeight[l] = x[peakIndex[l] * LANES + l] - prominence[l] / 2.0f;
+        leftIndex[l] = 0;
+        rightIndex[l] = size - 1;
+        rightOpen[l] = 1;
+    }
+
+    for (int i = 0; i < size; i++)
+    {
+        const float *row = &x[i * LANES];
+#pragma GCC unroll 1
+        for (int l = 0; l < LANES; l++)
+        {
+            int below = row[l] <= halfHeight[l];
+
+            int left = below & (i < peak[l]);
+            leftIndex[l] = left ? i : leftIndex[l];
+
+            int right = below & (i > peak[l]) & rightOpen[l];
+            rightIndex[l] = right ? i : rightIndex[l];
+            rightOpen[l] &= right ^ 1;
+        }
+    }
+
+    for (int l = 0; l < LANES; l++)
+    {
+        fwhm[l] = rightIndex[l] - leftIndex[l];
+        crossingIndices[l].left = leftIndex[l];
+        crossingIndices[l].right = rightIndex[l];
+    }
+}
+
+/*!
+ * @brief Determines for every lane if its peak continues past either end of the sweep.
+ *
+ * Equivalent to isPeakClimbing and isPeakFalling: the peak is climbing if fewer than two
+ * derivatives between the peak and the end of the sweep are less than or equal to the noise
+ * tolerance, and falling if the same holds for the derivatives towards the start. Both
+ * counts are gathered in one pass; counting all failures instead of stopping at the second
+ * one gives the same answer without a branch.
+ *
+ * @param x Lane-interleaved data.
+ * @param size The size of every sweep.
+ * @param peakIndex Peak index per lane.
+ * @param noiseTolerance The tolerance level for the derivative to be considered noise.
+ * @param climbing Output, climbing flag per lane.
+ * @param falling Output, falling flag per lane.
+ */
+static void classifyPeakEdgesBatch(const float x[], int size, const int peakIndex[], float noiseTolerance, bool climbing[], bool falling[])
+{
+    int peak[LANES];
+    int rightFailCount[LANES] = { 0 };
+    int leftFailCount[LANES] = { 0 };
+
+    for (int l = 0; l < LANES; l++)
+    {
+        peak[l] = peakIndex[l];
+    }
+
+    for (int i = 0; i < size - 1; i++)
+    {
+        const float *row = &x[i * LANES];
+        const float *next = &x[(i + 1) * LANES];
+#pragma GCC unroll 1
+        for (int l = 0; l < LANES; l++)
+        {
+            // The pair (i, i + 1) is a right step from i and a left step from i + 1
+            int rightFail = (i >= peak[l]) & (next[l] - row[l] <= noiseTolerance);
+            int leftFail = (i < peak[l]) & (row[l] - next[l] <= noiseTolerance);
+            rightFailCount[l] += rightFail;
+            leftFailCount[l] += leftFail;
+        }
+    }
+
+    for (int l = 0; l < LANES; l++)
+    {
+        int inside = (peak[l] > 0) & (peak[l] < size - 1);
+        climbing[l] = inside & (rightFailCount[l] < 2);
+        falling[l] = inside & (leftFailCount[l] < 2);
+    }
+}
+
+/*!
+ * @brief Determines the extent of the rejected peak of one lane.
+ *
+ * Equivalent to findPeakExtent: each flank is followed outward from the half-height crossing
+ * while the signal keeps descending, without passing the prominence boundaries. Only lanes
+ * that reject a peak need it, so it walks a single lane.
+ *
+ * @param x Lane-interleaved data.
+ * @param lane The lane of the rejected peak.
+ * @param crossingIndices The sample indices of the half-height crossings.
+ * @param boundaries The nearest higher samples (or ends) on both sides of the peak.
+ * @return The interval from the left base to the right base of the peak.
+ */
+static MqsInterval_t findPeakExtentBatch(const float x[], int lane, MqsInterval_t crossingIndices, MqsInterval_t boundaries)
+{
+    MqsInterval_t extent = crossingIndices;
+
+    while (extent.left > boundaries.left && x[(extent.left - 1) * LANES + lane] <= x[extent.left * LANES + lane])
+    {
+        extent.left--;
+    }
+    while (extent.right < boundaries.right && x[(extent.right + 1) * LANES + lane] <= x[extent.right * LANES + lane])
+    {
+        extent.right++;
+    }
+    return extent;
+}
+
+/*!
+ * @brief Processes and validates the peaks of up to MES_BATCH_LANES sweeps at once.
+ *
+ * Every attempt runs each stage over all lanes; the lane mask records which lanes are still
+ * searching. A lane leaves the mask once its peak is accepted, its prominence is too low or
+ * it runs out of attempts, and the batch terminates as soon as the mask is empty.
+ *
+ * @param interleaved Lane-interleaved phase angles, as produced by transposeSweepBatch.
+ * @param size The size of every sweep.
+ * @param laneMask Bit l set if lane l holds a sweep to analyse.
+ * @param peakIndex Array of MES_BATCH_LANES entries receiving the peak index per lane.
+ * @param isEdgeCase Array of MES_BATCH_LANES entries receiving the edge case flag per lane,
+ *                   written for every lane.
+ * @param truncatedEdge Array of MES_BATCH_LANES entries receiving the truncated ends per lane,
+ *                      may be NULL.
+ * @return Mask of the lanes whose peak was accepted, 0 if the indices of the sweeps do not
+ *         fit MqsIndex_t.
+ */
+uint32_t processPeakBatch(const float interleaved[], int size, uint32_t laneMask, MqsIndex_t peakIndex[], bool isEdgeCase[],
+                          MqsEdge_t truncatedEdge[])
+{
+    MqsInterval_t skipped[LANES][MAX_PEAK_ATTEMPTS];
+    MqsInterval_t boundaries[LANES];
+    MqsInterval_t crossingIndices[LANES];
+    float maxVal[LANES];
+    int maxIndex[LANES];
+    float prominence[LANES];
+    int fwhm[LANES];
+    bool climbing[LANES];
+    bool falling[LANES];
+    uint32_t active = laneMask & (uint32_t)((1ull << LANES) - 1);
+    uint32_t accepted = 0;
+
+    for (int l = 0; l < LANES; l++)
+    {
+        isEdgeCase[l] = false;
+        if (truncatedEdge != NULL)
+        {
+            truncatedEdge[l] = MQS_EDGE_NONE;
+        }
+        for (int k = 0; k < MAX_PEAK_ATTEMPTS; k++)
+        {
+            skipped[l][k].left = -1;
+            skipped[l][k].right = -2;
+        }
+    }
+
+    if (size <= 0)
+    {
+        return 0;
+    }
+
+#ifdef MES_INDEX_16BIT
+    // The indices of longer sweeps would not fit the result
+    if (size - 1 > MES_INDEX_MAX)
+    {
+        printf("Sweep too long for 16-bit indices.\n");
+        return 0;
+    }
+#endif
+
+    for (int attempt = 0; attempt < MAX_PEAK_ATTEMPTS && active != 0; attempt++)
+    {
+        maxrowBatch(interleaved, size, skipped, maxVal, maxIndex);
+        findProminenceBatch(interleaved, size - 1, maxIndex, prominence, boundaries);
+        calculateFWHMBatch(interleaved, size, maxIndex, prominence, fwhm, crossingIndices);
+        classifyPeakEdgesBatch(interleaved, size, maxIndex, NOISE_TOLERANCE, climbing, falling);
+
+        for (int l = 0; l < LANES; l++)
+        {
+            uint32_t bit = 1u << l;
+            if (!(active & bit))
+            {
+                continue;
+            }
+
+            peakIndex[l] = (MqsIndex_t)maxIndex[l];
+
+            if (prominence[l] <= MIN_PEAK_PROMINENCE)
+            {
+                active &= ~bit;
+                continue;
+            }
+
+            isEdgeCase[l] = maxIndex[l] >= size - PEAK_THRESHOLD && climbing[l];
+            if (truncatedEdge != NULL)
+            {
+                bool right = maxIndex[l] >= size - PEAK_THRESHOLD && climbing[l];
+                bool left = maxIndex[l] < PEAK_THRESHOLD && falling[l];
+                truncatedEdge[l] = (MqsEdge_t)((right ? MQS_EDGE_RIGHT : MQS_EDGE_NONE) | (left ? MQS_EDGE_LEFT : MQS_EDGE_NONE));
+            }
+
+            if (fwhm[l] > MIN_PEAK_FWHM)
+            {
+                accepted |= bit;
+                active &= ~bit;
+            }
+            else
+            {
+                skipped[l][attempt] = findPeakExtentBatch(interleaved, l, crossingIndices[l], boundaries[l]);
+            }
+        }
+    }
+
+    return accepted;
+}
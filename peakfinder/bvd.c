@@ -0,0 +1,121 @@
+/*!
+ * Butterworth-Van Dyke Extraction
+ *
+ * Description:
+ * Converts the resonance, anti-resonance, minimum impedance and half-power bandwidth of a
+ * sweep into the parameters of the Butterworth-Van Dyke equivalent circuit of a piezo
+ * resonator. The conversion is closed form, so it runs inline with detection over whole
+ * batches of sweeps instead of in a separate offline stage.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <stdbool.h>
+#include "mes_bvd.h"
+#include "mes_noalloc.h"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+/*!
+ * @brief Returns x if mask is all ones and 0 if it is all zeros, without a branch.
+ */
+static inline float maskFloat(float x, uint32_t mask)
+{
+    uint32_t bits;
+    memcpy(&bits, &x, sizeof bits);
+    bits &= mask;
+    memcpy(&x, &bits, sizeof x);
+    return x;
+}
+
+/*!
+ * @brief Returns the distance in samples from index to the point where the impedance reaches level.
+ *
+ * Walks in the given direction and interpolates linearly between the last two samples.
+ *
+ * @return The distance, or -1 if the level is not reached inside the sweep.
+ */
+static float findImpedanceRise(const MqsRawDataPoint_t a[], int size, int index, int direction, float level)
+{
+    for (int i = index; i + direction >= 0 && i + direction < size; i += direction)
+    {
+        float current = a[i].impedance;
+        float next = a[i + direction].impedance;
+        if (next >= level)
+        {
+            float fraction = (next != current) ? (level - current) / (next - current) : 0.0f;
+            return (float)abs(i - index) + fraction;
+        }
+    }
+    return -1.0f;
+}
+
+bool measureBvd(const MqsRawDataPoint_t a[], int size, const MqsResonancePair_t *pair, float frequencyStep,
+                const MqsBvdMeasurements_t *measurements, int slot)
+{
+    int index = pair->resonanceIndex;
+    float minimum = a[index].impedance;
+    float level = minimum * sqrtf(2.0f);
+    float left = findImpedanceRise(a, size, index, -1, level);
+    float right = findImpedanceRise(a, size, index, 1, level);
+    float width = (left >= 0.0f && right >= 0.0f) ? left + right : 2.0f * ((left >= 0.0f) ? left : right);
+
+    measurements->seriesFrequency[slot] = pair->resonanceFrequency;
+    measurements->parallelFrequency[slot] = pair->antiResonanceFrequency;
+    measurements->seriesResistance[slot] = minimum;
+    measurements->bandwidth[slot] = width * fabsf(frequencyStep);
+
+    if (left < 0.0f && right < 0.0f)
+    {
+        measurements->seriesFrequency[slot] = 0.0f;
+        measurements->parallelFrequency[slot] = 0.0f;
+        measurements->seriesResistance[slot] = 0.0f;
+        measurements->bandwidth[slot] = 0.0f;
+        return false;
+    }
+    return true;
+}
+
+/*!
+ * @brief Closed-form extraction over arrays that do not alias, so the loop vectorises.
+ */
+static int extractBvdArrays(const float *restrict fs, const float *restrict fp, const float *restrict r,
+                            const float *restrict bandwidth, int count, float *restrict resistance,
+                            float *restrict inductance, float *restrict capacitance,
+                            float *restrict shuntCapacitance, float *restrict quality)
+{
+    int valid = 0;
+
+    for (int k = 0; k < count; k++)
+    {
+        // Every entry is computed; unphysical ones are masked to 0 instead of skipped
+        int physical = (fs[k] > 0.0f) & (fp[k] > fs[k]) & (r[k] > 0.0f) & (bandwidth[k] > 0.0f);
+        uint32_t mask = 0u - (uint32_t)physical;
+
+        float omega = 2.0f * (float)M_PI * fs[k];
+        float q = fs[k] / bandwidth[k];
+        float ratio = fp[k] / fs[k];
+        float c1 = 1.0f / (omega * q * r[k]);
+
+        resistance[k] = maskFloat(r[k], mask);
+        quality[k] = maskFloat(q, mask);
+        inductance[k] = maskFloat(q * r[k] / omega, mask);
+        capacitance[k] = maskFloat(c1, mask);
+        shuntCapacitance[k] = maskFloat(c1 / (ratio * ratio - 1.0f), mask);
+        valid += physical;
+    }
+    return valid;
+}
+
+int extractBvdBatch(const MqsBvdMeasurements_t *measurements, int count, const MqsBvdParameters_t *parameters)
+{
+    return extractBvdArrays(measurements->seriesFrequency, measurements->parallelFrequency,
+                            measurements->seriesResistance, measurements->bandwidth, count,
+                            parameters->resistance, parameters->inductance, parameters->capacitance,
+                            parameters->shuntCapacitance, parameters->quality);
+}
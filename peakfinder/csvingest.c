@@ -0,0 +1,657 @@
+/*!
+ * Parallel CSV Ingestion
+ *
+ * Description:
+ * Front end that turns exported text sweeps into MqsRawDataPoint_t buffers for the
+ * detectors. The input is split into chunks of about CSV_INGEST_CHUNK_BYTES; chunk borders
+ * are moved forward to the next blank line so that no sweep straddles two chunks. The
+ * threads parse the chunks with a locale-free float parser into a bounded ring of reusable
+ * arenas, and the calling thread streams the sweeps to the caller in input order, in
+ * batches sized for processPeakBatch, while later chunks are still being parsed. An arena
+ * goes back to the parsers as soon as all its sweeps have been delivered, so memory stays
+ * bounded by the queue depth rather than by the size of the input.
+ */
+
+#if !defined(_POSIX_C_SOURCE) && !defined(_WIN32)
+#define _POSIX_C_SOURCE 200112L
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+#include "mes_csvingest.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define CSV_INGEST_POSIX 1
+#else
+#define CSV_INGEST_POSIX 0
+#endif
+
+/*!
+ * @brief Shared state of one csvIngestBuffer call.
+ *
+ * Chunk k is parsed into slot k % depth, which may only be claimed once chunk k - depth has
+ * been released by the consumer.
+ */
+typedef struct {
+    MqsCsvIngest_t *ingest;
+    const char *data;
+    size_t length;
+    size_t nextBegin;   // Start of the first chunk not handed out yet
+    size_t claimed;     // Number of chunks handed out
+    size_t released;    // Number of chunks whose sweeps have all been delivered
+    int depth;
+    bool finished;      // The last chunk has been handed out
+#if CSV_INGEST_POSIX
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+#endif
+} CsvQueue_t;
+
+/*!
+ * @brief Exact powers of ten representable in a double.
+ */
+static const double powersOfTen[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+const char *csvParseFloat(const char *p, const char *end, float *value)
+{
+    bool negative = false;
+    uint64_t mantissa = 0;
+    int digits = 0;
+    int exponent = 0;
+
+    if (p < end && (*p == '-' || *p == '+'))
+    {
+        negative = *p == '-';
+        p++;
+    }
+
+    const char *start = p;
+    for (; p < end && *p >= '0' && *p <= '9'; p++)
+    {
+        // Digits beyond what fits the mantissa only scale the value
+        if (digits < 19)
+        {
+            mantissa = mantissa * 10 + (uint64_t)(*p - '0');
+            digits += (mantissa != 0);
+        }
+        else
+        {
+            exponent++;
+        }
+    }
+
+    if (p < end && *p == '.')
+    {
+        p++;
+        for (; p < end && *p >= '0' && *p <= '9'; p++)
+        {
+            if (digits < 19)
+            {
+                mantissa = mantissa * 10 + (uint64_t)(*p - '0');
+                digits += (mantissa != 0);
+                exponent--;
+            }
+        }
+    }
+
+    if (p == start || (p == start + 1 && *start == '.'))
+    {
+        return NULL;
+    }
+
+    if (p < end && (*p == 'e' || *p == 'E'))
+    {
+        const char *q = p + 1;
+        bool negativeExponent = false;
+        int e = 0;
+
+        if (q < end && (*q == '-' || *q == '+'))
+        {
+            negativeExponent = *q == '-';
+            q++;
+        }
+        if (q < end && *q >= '0' && *q <= '9')
+        {
+            for (; q < end && *q >= '0' && *q <= '9'; q++)
+            {
+                e = (e < 10000) ? e * 10 + (*q - '0') : e;
+            }
+            exponent += negativeExponent ? -e : e;
+            p = q;
+        }
+    }
+
+    double result = (double)mantissa;
+    while (exponent > 22)
+    {
+        result *= 1e22;
+        exponent -= 22;
+    }
+    while (exponent < -22)
+    {
+        result /= 1e22;
+        exponent += 22;
+    }
+    result = (exponent >= 0) ? result * powersOfTen[exponent] : result / powersOfTen[-exponent];
+
+    *value = (float)(negative ? -result : result);
+    return p;
+}
+
+/*!
+ * @brief Returns true if the line [p, end) holds only white space.
+ */
+static bool isBlankLine(const char *p, const char *end)
+{
+    for (; p < end; p++)
+    {
+        if (*p != ' ' && *p != '\t' && *p != '\r')
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*!
+ * @brief Moves a chunk border forward to the start of the line after the next blank line.
+ *
+ * @param data Start of the text.
+ * @param length The length of the text.
+ * @param position The nominal border.
+ * @return The adjusted border, or length if no blank line follows.
+ */
+static size_t alignToSweepBoundary(const char *data, size_t length, size_t position)
+{
+    // Start at the beginning of the next line
+    while (position > 0 && position < length && data[position - 1] != '\n')
+    {
+        position++;
+    }
+
+    while (position < length)
+    {
+        const char *lineEnd = memchr(data + position, '\n', length - position);
+        size_t next = (lineEnd != NULL) ? (size_t)(lineEnd - data) + 1 : length;
+
+        if (isBlankLine(data + position, data + next - (lineEnd != NULL)))
+        {
+            return next;
+        }
+        position = next;
+    }
+    return length;
+}
+
+/*!
+ * @brief Grows the point arena of a chunk so it holds at least the given number of points.
+ */
+static bool reservePoints(MqsCsvChunk_t *chunk, size_t count)
+{
+    if (count <= chunk->pointCapacity)
+    {
+        return true;
+    }
+
+    size_t capacity = (chunk->pointCapacity > 0) ? chunk->pointCapacity : 1024;
+    while (capacity < count)
+    {
+        capacity *= 2;
+    }
+
+    MqsRawDataPoint_t *points = realloc(chunk->points, capacity * sizeof(MqsRawDataPoint_t));
+    if (points == NULL)
+    {
+        return false;
+    }
+    chunk->points = points;
+    chunk->pointCapacity = capacity;
+    return true;
+}
+
+/*!
+ * @brief Closes the sweep being built, if it holds any point.
+ */
+static bool endSweep(MqsCsvChunk_t *chunk, size_t sweepStart)
+{
+    if (chunk->pointCount == sweepStart)
+    {
+        return true;
+    }
+
+    if (chunk->sweepCount == chunk->sweepCapacity)
+    {
+        size_t capacity = (chunk->sweepCapacity > 0) ? chunk->sweepCapacity * 2 : 64;
+        size_t *starts = realloc(chunk->sweepStart, capacity * sizeof(size_t));
+        if (starts == NULL)
+        {
+            return false;
+        }
+        chunk->sweepStart = starts;
+
+        int *sizes = realloc(chunk->sweepSize, capacity * sizeof(int));
+        if (sizes == NULL)
+        {
+            return false;
+        }
+        chunk->sweepSize = sizes;
+        chunk->sweepCapacity = capacity;
+    }
+
+    chunk->sweepStart[chunk->sweepCount] = sweepStart;
+    chunk->sweepSize[chunk->sweepCount] = (int)(chunk->pointCount - sweepStart);
+    chunk->sweepCount++;
+    return true;
+}
+
+/*!
+ * @brief Parses one line into a sweep point.
+ *
+ * @return true if both the phase and the impedance columns hold numbers.
+ */
+static bool parseLine(const char *p, const char *end, const MqsCsvFormat_t *format, MqsRawDataPoint_t *point)
+{
+    int lastColumn = (format->phaseColumn > format->impedanceColumn) ? format->phaseColumn : format->impedanceColumn;
+    bool havePhase = false;
+    bool haveImpedance = false;
+
+    for (int column = 0; column <= lastColumn && p <= end; column++)
+    {
+        const char *fieldEnd = memchr(p, format->delimiter, (size_t)(end - p));
+        if (fieldEnd == NULL)
+        {
+            fieldEnd = end;
+        }
+
+        if (column == format->phaseColumn || column == format->impedanceColumn)
+        {
+            const char *q = p;
+            while (q < fieldEnd && (*q == ' ' || *q == '\t'))
+            {
+                q++;
+            }
+
+            float value;
+            if (csvParseFloat(q, fieldEnd, &value) == NULL)
+            {
+                return false;
+            }
+            if (column == format->phaseColumn)
+            {
+                point->phaseAngle = value;
+                havePhase = true;
+            }
+            if (column == format->impedanceColumn)
+            {
+                point->impedance = value;
+                haveImpedance = true;
+            }
+        }
+        p = fieldEnd + 1;
+    }
+
+    return havePhase && haveImpedance;
+}
+
+/*!
+ * @brief Parses all sweeps of one chunk into its arena.
+ */
+static void *parseChunk(void *argument)
+{
+    MqsCsvChunk_t *chunk = argument;
+    const char *p = chunk->begin;
+    size_t sweepStart = 0;
+
+    chunk->pointCount = 0;
+    chunk->sweepCount = 0;
+    chunk->ok = true;
+
+    while (p < chunk->end)
+    {
+        const char *lineEnd = memchr(p, '\n', (size_t)(chunk->end - p));
+        if (lineEnd == NULL)
+        {
+            lineEnd = chunk->end;
+        }
+        const char *contentEnd = (lineEnd > p && lineEnd[-1] == '\r') ? lineEnd - 1 : lineEnd;
+
+        if (isBlankLine(p, contentEnd))
+        {
+            if (!endSweep(chunk, sweepStart))
+            {
+                chunk->ok = false;
+                return NULL;
+            }
+            sweepStart = chunk->pointCount;
+        }
+        else
+        {
+            if (!reservePoints(chunk, chunk->pointCount + 1))
+            {
+                chunk->ok = false;
+                return NULL;
+            }
+            if (parseLine(p, contentEnd, chunk->format, &chunk->points[chunk->pointCount]))
+            {
+                chunk->pointCount++;
+            }
+        }
+        p = lineEnd + 1;
+    }
+
+    chunk->ok = endSweep(chunk, sweepStart);
+    return NULL;
+}
+
+/*!
+ * @brief Locks the queue; a no-op without threads.
+ */
+static void lockQueue(CsvQueue_t *queue)
+{
+#if CSV_INGEST_POSIX
+    pthread_mutex_lock(&queue->lock);
+#else
+    (void)queue;
+#endif
+}
+
+/*!
+ * @brief Unlocks the queue and wakes all waiting threads if anything changed.
+ */
+static void unlockQueue(CsvQueue_t *queue, bool changed)
+{
+#if CSV_INGEST_POSIX
+    if (changed)
+    {
+        pthread_cond_broadcast(&queue->changed);
+    }
+    pthread_mutex_unlock(&queue->lock);
+#else
+    (void)queue;
+    (void)changed;
+#endif
+}
+
+/*!
+ * @brief Waits with the queue locked until another thread changes it.
+ */
+static void waitQueue(CsvQueue_t *queue)
+{
+#if CSV_INGEST_POSIX
+    pthread_cond_wait(&queue->changed, &queue->lock);
+#else
+    (void)queue;
+#endif
+}
+
+/*!
+ * @brief Returns true if the next chunk may be claimed; call with the queue locked.
+ */
+static bool canClaim(const CsvQueue_t *queue)
+{
+    return !queue->finished && queue->claimed < queue->released + (size_t)queue->depth;
+}
+
+/*!
+ * @brief Hands out the next chunk and its slot; call with the queue locked and canClaim true.
+ */
+static MqsCsvChunk_t *claimChunk(CsvQueue_t *queue)
+{
+    MqsCsvChunk_t *chunk = &queue->ingest->chunks[queue->claimed % (size_t)queue->depth];
+    size_t begin = queue->nextBegin;
+    size_t end = (queue->length - begin > CSV_INGEST_CHUNK_BYTES) ?
+                 alignToSweepBoundary(queue->data, queue->length, begin + CSV_INGEST_CHUNK_BYTES) : queue->length;
+
+    chunk->begin = queue->data + begin;
+    chunk->end = queue->data + end;
+    chunk->format = &queue->ingest->format;
+    chunk->ready = false;
+
+    queue->nextBegin = end;
+    queue->claimed++;
+    queue->finished = end == queue->length;
+    return chunk;
+}
+
+/*!
+ * @brief Marks chunks [0, count) as delivered so their slots can be reused.
+ */
+static void releaseChunks(CsvQueue_t *queue, size_t count)
+{
+    lockQueue(queue);
+    bool changed = count > queue->released;
+    if (changed)
+    {
+        queue->released = count;
+    }
+    unlockQueue(queue, changed);
+}
+
+#if CSV_INGEST_POSIX
+/*!
+ * @brief Parser thread: claims and parses chunks until the input is exhausted.
+ */
+static void *parseWorker(void *argument)
+{
+    CsvQueue_t *queue = argument;
+
+    lockQueue(queue);
+    while (!queue->finished)
+    {
+        if (!canClaim(queue))
+        {
+            waitQueue(queue);
+            continue;
+        }
+
+        MqsCsvChunk_t *chunk = claimChunk(queue);
+        unlockQueue(queue, false);
+        parseChunk(chunk);
+        lockQueue(queue);
+        chunk->ready = true;
+        pthread_cond_broadcast(&queue->changed);
+    }
+    unlockQueue(queue, false);
+    return NULL;
+}
+#endif
+
+void csvIngestInit(MqsCsvIngest_t *ingest, const MqsCsvFormat_t *format, int numThreads)
+{
+    memset(ingest, 0, sizeof(*ingest));
+    ingest->format = *format;
+
+    if (numThreads < 1)
+    {
+        numThreads = 1;
+    }
+    if (numThreads > CSV_INGEST_MAX_THREADS)
+    {
+        numThreads = CSV_INGEST_MAX_THREADS;
+    }
+    ingest->numThreads = numThreads;
+}
+
+bool csvIngestBuffer(MqsCsvIngest_t *ingest, const char *data, size_t length, MqsSweepBatchCallback_t callback, void *user)
+{
+    CsvQueue_t queue = { 0 };
+    queue.ingest = ingest;
+    queue.data = data;
+    queue.length = length;
+    queue.depth = 2 * ingest->numThreads;
+    queue.finished = length == 0;
+
+#if CSV_INGEST_POSIX
+    pthread_t threads[CSV_INGEST_MAX_THREADS];
+    int numWorkers = 0;
+
+    pthread_mutex_init(&queue.lock, NULL);
+    pthread_cond_init(&queue.changed, NULL);
+    for (int t = 1; t < ingest->numThreads; t++)
+    {
+        // Chunks a worker fails to take are parsed by the calling thread
+        if (pthread_create(&threads[numWorkers], NULL, parseWorker, &queue) == 0)
+        {
+            numWorkers++;
+        }
+    }
+#endif
+
+    // Stream the sweeps in input order
+    MqsRawDataPoint_t *batch[MES_BATCH_LANES];
+    int sizes[MES_BATCH_LANES];
+    int count = 0;
+    bool ok = true;
+
+    for (size_t k = 0;; k++)
+    {
+        MqsCsvChunk_t *chunk = &ingest->chunks[k % (size_t)queue.depth];
+        bool done = false;
+
+        lockQueue(&queue);
+        for (;;)
+        {
+            if (k < queue.claimed && chunk->ready)
+            {
+                break;
+            }
+            if (queue.finished && k >= queue.claimed)
+            {
+                done = true;
+                break;
+            }
+            if (canClaim(&queue))
+            {
+                // Parse the next chunk here rather than wait for the workers
+                MqsCsvChunk_t *own = claimChunk(&queue);
+                unlockQueue(&queue, false);
+                parseChunk(own);
+                lockQueue(&queue);
+                own->ready = true;
+                continue;
+            }
+            waitQueue(&queue);
+        }
+        unlockQueue(&queue, false);
+        if (done)
+        {
+            break;
+        }
+
+        ok = ok && chunk->ok;
+        for (size_t s = 0; s < chunk->sweepCount; s++)
+        {
+            batch[count] = &chunk->points[chunk->sweepStart[s]];
+            sizes[count] = chunk->sweepSize[s];
+            if (++count == MES_BATCH_LANES)
+            {
+                callback(batch, sizes, count, user);
+                count = 0;
+                releaseChunks(&queue, (s + 1 == chunk->sweepCount) ? k + 1 : k);
+            }
+        }
+
+        // A partial batch holds on to its chunks; flush it before it could stall the parsers
+        if (count > 0 && k + 1 - queue.released >= (size_t)queue.depth - 1)
+        {
+            callback(batch, sizes, count, user);
+            count = 0;
+        }
+        if (count == 0)
+        {
+            releaseChunks(&queue, k + 1);
+        }
+    }
+    if (count > 0)
+    {
+        callback(batch, sizes, count, user);
+    }
+
+#if CSV_INGEST_POSIX
+    for (int t = 0; t < numWorkers; t++)
+    {
+        pthread_join(threads[t], NULL);
+    }
+    pthread_cond_destroy(&queue.changed);
+    pthread_mutex_destroy(&queue.lock);
+#endif
+
+    return ok;
+}
+
+bool csvIngestFile(MqsCsvIngest_t *ingest, const char *path, MqsSweepBatchCallback_t callback, void *user)
+{
+#if CSV_INGEST_POSIX
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+    {
+        close(fd);
+        return false;
+    }
+    if (st.st_size == 0)
+    {
+        close(fd);
+        return true;
+    }
+
+    void *data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+    {
+        return false;
+    }
+
+    posix_madvise(data, (size_t)st.st_size, POSIX_MADV_SEQUENTIAL);
+    bool ok = csvIngestBuffer(ingest, data, (size_t)st.st_size, callback, user);
+    munmap(data, (size_t)st.st_size);
+    return ok;
+#else
+    FILE *file = fopen(path, "rb");
+    if (file == NULL)
+    {
+        return false;
+    }
+
+    fseek(file, 0, SEEK_END);
+    long length = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    char *data = (length > 0) ? malloc((size_t)length) : NULL;
+    bool ok = length == 0 || (data != NULL && fread(data, 1, (size_t)length, file) == (size_t)length);
+    fclose(file);
+
+    if (ok && length > 0)
+    {
+        ok = csvIngestBuffer(ingest, data, (size_t)length, callback, user);
+    }
+    free(data);
+    return ok;
+#endif
+}
+
+void csvIngestFree(MqsCsvIngest_t *ingest)
+{
+    for (int c = 0; c < CSV_INGEST_QUEUE_DEPTH; c++)
+    {
+        free(ingest->chunks[c].points);
+        free(ingest->chunks[c].sweepStart);
+        free(ingest->chunks[c].sweepSize);
+    }
+    memset(ingest, 0, sizeof(*ingest));
+}
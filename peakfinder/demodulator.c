@@ -0,0 +1,147 @@
+/*!
+ * Goertzel Demodulation
+ *
+ * Description:
+ * Computes the sweep points of boards that sample the excitation and the response in the
+ * time domain. Each sweep frequency gets a Goertzel filter on both signals, which costs one
+ * multiply-add per sample and frequency, instead of an FFT per frequency.
+ *
+ * After N samples, a Goertzel filter at w yields e^(jw(N-1)) times the DFT of the record at
+ * w. The factor is the same for the excitation and the response, so it cancels in their
+ * ratio, and any frequency can be used, not only the bins of an FFT.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+#include <stdbool.h>
+#include "mes_demodulator.h"
+#include "mes_workspace.h"
+#include "mes_noalloc.h"
+
+#define DEMODULATOR_PI 3.14159265358979323846
+
+size_t goertzelBankWorkspaceSize(int numFrequencies)
+{
+    return 7 * WORKSPACE_BYTES(numFrequencies, float) + WORKSPACE_ALIGNMENT;
+}
+
+bool goertzelBankInit(MqsGoertzelBank_t *bank, const float frequencies[], int numFrequencies, float sampleRate, MqsWorkspace_t *workspace)
+{
+    size_t bytes = (size_t)numFrequencies * sizeof(float);
+
+    bank->numFrequencies = numFrequencies;
+    bank->coefficient = workspaceAlloc(workspace, bytes);
+    bank->cosine = workspaceAlloc(workspace, bytes);
+    bank->sine = workspaceAlloc(workspace, bytes);
+    bank->excitation1 = workspaceAlloc(workspace, bytes);
+    bank->excitation2 = workspaceAlloc(workspace, bytes);
+    bank->response1 = workspaceAlloc(workspace, bytes);
+    bank->response2 = workspaceAlloc(workspace, bytes);
+
+    if (bank->coefficient == NULL || bank->cosine == NULL || bank->sine == NULL || bank->excitation1 == NULL ||
+        bank->excitation2 == NULL || bank->response1 == NULL || bank->response2 == NULL)
+    {
+        return false;
+    }
+
+    for (int f = 0; f < numFrequencies; f++)
+    {
+        double w = 2.0 * DEMODULATOR_PI * frequencies[f] / sampleRate;
+        bank->cosine[f] = (float)cos(w);
+        bank->sine[f] = (float)sin(w);
+        bank->coefficient[f] = (float)(2.0 * cos(w));
+    }
+
+    goertzelBankReset(bank);
+    return true;
+}
+
+void goertzelBankReset(MqsGoertzelBank_t *bank)
+{
+    for (int f = 0; f < bank->numFrequencies; f++)
+    {
+        bank->excitation1[f] = 0.0f;
+        bank->excitation2[f] = 0.0f;
+        bank->response1[f] = 0.0f;
+        bank->response2[f] = 0.0f;
+    }
+}
+
+void goertzelBankUpdate(MqsGoertzelBank_t *bank, const float excitation[], const float response[], int count)
+{
+    int numFrequencies = bank->numFrequencies;
+    const float *restrict coefficient = bank->coefficient;
+    float *restrict excitation1 = bank->excitation1;
+    float *restrict excitation2 = bank->excitation2;
+    float *restrict response1 = bank->response1;
+    float *restrict response2 = bank->response2;
+
+    for (int n = 0; n < count; n++)
+    {
+        float v = excitation[n];
+        float i = response[n];
+
+        // Independent filters, one per frequency: this loop is vectorised across frequencies
+        for (int f = 0; f < numFrequencies; f++)
+        {
+            float v0 = v + coefficient[f] * excitation1[f] - excitation2[f];
+            float i0 = i + coefficient[f] * response1[f] - response2[f];
+            excitation2[f] = excitation1[f];
+            excitation1[f] = v0;
+            response2[f] = response1[f];
+            response1[f] = i0;
+        }
+    }
+}
+
+int goertzelBankFinish(const MqsGoertzelBank_t *bank, MqsRawDataPoint_t points[])
+{
+    int valid = 0;
+
+    for (int f = 0; f < bank->numFrequencies; f++)
+    {
+        float c = bank->cosine[f];
+        float s = bank->sine[f];
+
+        // y = s[N-1] - e^(-jw) s[N-2]
+        float vRe = bank->excitation1[f] - c * bank->excitation2[f];
+        float vIm = s * bank->excitation2[f];
+        float iRe = bank->response1[f] - c * bank->response2[f];
+        float iIm = s * bank->response2[f];
+
+        // Z = V / I, unless there is no current to divide by
+        float denominator = iRe * iRe + iIm * iIm;
+        if (!(denominator > DEMODULATOR_MIN_CURRENT_RATIO * (vRe * vRe + vIm * vIm)))
+        {
+            points[f].phaseAngle = 0.0f;
+            points[f].impedance = 0.0f;
+            continue;
+        }
+        float zRe = (vRe * iRe + vIm * iIm) / denominator;
+        float zIm = (vIm * iRe - vRe * iIm) / denominator;
+
+        points[f].phaseAngle = (float)(atan2f(zIm, zRe) * (180.0 / DEMODULATOR_PI));
+        points[f].impedance = sqrtf(zRe * zRe + zIm * zIm);
+        valid++;
+    }
+    return valid;
+}
+
+bool demodulateSweep(const float excitation[], const float response[], int numSamples, float sampleRate,
+                     const float frequencies[], int numFrequencies, MqsWorkspace_t *workspace, MqsRawDataPoint_t points[])
+{
+    MqsGoertzelBank_t bank;
+    size_t mark = workspaceMark(workspace);
+    bool ok = goertzelBankInit(&bank, frequencies, numFrequencies, sampleRate, workspace);
+
+    if (ok)
+    {
+        goertzelBankUpdate(&bank, excitation, response, numSamples);
+        ok = goertzelBankFinish(&bank, points) > 0;
+    }
+
+    workspaceRelease(workspace, mark);
+    return ok;
+}
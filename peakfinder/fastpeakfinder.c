@@ -12,31 +12,220 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
 #include <math.h>
 #include <stdbool.h>
 #include "mes_peakfinder.h"
+#include "mes_workspace.h"
+#include "mes_phaseunwrap.h"
+#include "mes_hampel.h"
+#include "mes_baseline.h"
+#include "mes_noise.h"
+#include "mes_phasescan.h"
+#include "mes_noalloc.h"
 
+/*!
+ * @brief Smoothing filter applied to the phase angle while the detector reads it.
+ *
+ * Holds one set of filter coefficients per half window, from 0 up to the configured one.
+ * Near the ends of the sweep the window shrinks symmetrically so the filter never reads
+ * outside the array and does not shift the peak. A copy of the channel's baseline
+ * polynomial, if any, is subtracted after filtering.
+ */
+typedef struct {
+    int size;       // Length of the sweep
+    int halfWindow; // Configured half window, 0 if only the baseline is removed
+    float coefficients[MES_SMOOTH_MAX_WINDOW / 2 + 1][MES_SMOOTH_MAX_WINDOW];
+    int baselineDegree;   // Degree of the subtracted baseline, -1 if none
+    float baselineScale;  // Scale of the normalised abscissa of the baseline
+    float baseline[MES_BASELINE_MAX_DEGREE + 1];
+} Smoother_t;
 
 /*!
- * @brief Defines the noise tolerance level for validating edge case climbing peaks.
+ * @brief Computes the Savitzky-Golay smoothing coefficients of one window.
+ *
+ * The value at the centre of the least-squares polynomial of the given order through the
+ * 2 * half + 1 samples is a weighted sum of the samples; the weights are the first row of
+ * the inverse of the normal equations, evaluated at each sample. Abscissae are scaled to
+ * [-1, 1] to keep the normal equations well conditioned.
  *
- * This constant represents the threshold for noise tolerance used in determining whether a peak 
- * is still climbing at the end of a dataset. It is used in the context of peak analysis to 
- * distinguish between genuine rising peaks and minor fluctuations that could be attributed 
- * to noise. A lower value indicates stricter criteria for a peak to be considered as climbing.
+ * @param half The half window.
+ * @param order The order of the polynomial, at most 2 * half.
+ * @param coefficients Output, the 2 * half + 1 weights.
  */
-#define NOISE_TOLERANCE 0.9f 
+static void savitzkyGolayCoefficients(int half, int order, float coefficients[])
+{
+    double gram[MES_SMOOTH_MAX_ORDER + 1][MES_SMOOTH_MAX_ORDER + 2];
+    int n = order + 1;
+
+    // Normal equations, augmented with the first unit vector
+    for (int k = 0; k < n; k++)
+    {
+        for (int l = 0; l < n; l++)
+        {
+            double sum = 0.0;
+            for (int j = -half; j <= half; j++)
+            {
+                sum += pow((double)j / half, k + l);
+            }
+            gram[k][l] = sum;
+        }
+        gram[k][n] = (k == 0) ? 1.0 : 0.0;
+    }
+
+    // Gauss-Jordan elimination with partial pivoting
+    for (int k = 0; k < n; k++)
+    {
+        int pivot = k;
+        for (int r = k + 1; r < n; r++)
+        {
+            if (fabs(gram[r][k]) > fabs(gram[pivot][k]))
+            {
+                pivot = r;
+            }
+        }
+        for (int c = 0; c <= n; c++)
+        {
+            double tmp = gram[k][c];
+            gram[k][c] = gram[pivot][c];
+            gram[pivot][c] = tmp;
+        }
+        for (int r = 0; r < n; r++)
+        {
+            if (r != k)
+            {
+                double factor = gram[r][k] / gram[k][k];
+                for (int c = k; c <= n; c++)
+                {
+                    gram[r][c] -= factor * gram[k][c];
+                }
+            }
+        }
+    }
+
+    for (int j = -half; j <= half; j++)
+    {
+        double weight = 0.0;
+        for (int k = 0; k < n; k++)
+        {
+            weight += gram[k][n] / gram[k][k] * pow((double)j / half, k);
+        }
+        coefficients[j + half] = (float)weight;
+    }
+}
 
 /*!
- * @brief Defines the threshold for identifying edge case peaks in a dataset.
+ * @brief Prepares the smoothing filter selected by the configuration.
  *
- * This constant sets the threshold for defining edge case peaks. An edge case peak is 
- * identified when the peak is near the end of the dataset and has not reached its maximum 
- * (climax) within the dataset's interval. This threshold value determines how close to the 
- * end of the dataset a peak must be to be considered an edge case. It is used to decide 
- * whether to check if a peak is still climbing or if it may continue in a subsequent dataset.
+ * @param config The detector configuration.
+ * @param size The length of the sweep.
+ * @param smoother Output, the filter.
+ * @return The filter, or NULL if the configuration selects no smoothing.
  */
-#define PEAK_THRESHOLD  30 
+static const Smoother_t *initSmoother(const MqsPeakConfig_t *config, int size, Smoother_t *smoother)
+{
+    int window = config->smoothingWindow;
+    bool smoothing = config->smoothing != MQS_SMOOTH_NONE && window >= 3;
+    bool detrending = config->baseline != NULL && config->baseline->valid && config->baseline->size == size;
+
+    if (!smoothing && !detrending)
+    {
+        return NULL;
+    }
+    if (!smoothing)
+    {
+        window = 1;
+    }
+    if (window > MES_SMOOTH_MAX_WINDOW)
+    {
+        window = MES_SMOOTH_MAX_WINDOW;
+    }
+
+    smoother->size = size;
+    smoother->halfWindow = window / 2;
+    smoother->baselineDegree = -1;
+    smoother->baselineScale = 0.0f;
+
+    if (detrending)
+    {
+        smoother->baselineDegree = config->baseline->degree;
+        smoother->baselineScale = config->baseline->scale;
+        for (int k = 0; k <= config->baseline->degree; k++)
+        {
+            smoother->baseline[k] = config->baseline->coefficients[k];
+        }
+    }
+
+    for (int half = 0; half <= smoother->halfWindow; half++)
+    {
+        int order = config->smoothingOrder;
+        order = (order < 0) ? 0 : (order > MES_SMOOTH_MAX_ORDER) ? MES_SMOOTH_MAX_ORDER : order;
+        order = (order > 2 * half) ? 2 * half : order;
+
+        if (half == 0)
+        {
+            smoother->coefficients[0][0] = 1.0f;
+        }
+        else if (config->smoothing == MQS_SMOOTH_SAVITZKY_GOLAY && order > 1)
+        {
+            savitzkyGolayCoefficients(half, order, smoother->coefficients[half]);
+        }
+        else
+        {
+            // Moving average, also the Savitzky-Golay filter of order 0 and 1
+            for (int j = 0; j <= 2 * half; j++)
+            {
+                smoother->coefficients[half][j] = 1.0f / (2 * half + 1);
+            }
+        }
+    }
+    return smoother;
+}
+
+/*!
+ * @brief Returns the phase angle of sample i, smoothed and detrended if a filter is given.
+ *
+ * The smoothed value is computed from the neighbouring raw samples on every access, and the
+ * baseline subtracted from it, so no smoothed or detrended copy of the sweep is ever written.
+ *
+ * @param a The array of data points (MqsRawDataPoint_t).
+ * @param i The index of the sample.
+ * @param smoother The filter, or NULL for the raw phase angle.
+ * @return The (smoothed) phase angle.
+ */
+static inline float phaseAt(const MqsRawDataPoint_t a[], int i, const Smoother_t *smoother)
+{
+    if (smoother == NULL)
+    {
+        return a[i].phaseAngle;
+    }
+
+    int half = smoother->halfWindow;
+    half = (half > i) ? i : half;
+    half = (half > smoother->size - 1 - i) ? smoother->size - 1 - i : half;
+
+    const float *c = smoother->coefficients[half];
+    float sum = 0.0f;
+    for (int j = -half; j <= half; j++)
+    {
+        sum += c[j + half] * a[i + j].phaseAngle;
+    }
+
+    if (smoother->baselineDegree < 0)
+    {
+        return sum;
+    }
+
+    // Horner evaluation of the baseline, in the abscissa normalised to [-1, 1]
+    float t = (float)i * smoother->baselineScale - 1.0f;
+    float drift = 0.0f;
+    for (int k = smoother->baselineDegree; k >= 0; k--)
+    {
+        drift = drift * t + smoother->baseline[k];
+    }
+    return sum - drift;
+}
+
 
 /*!
  * @brief Calculates the prominence of a peak in a dataset.
@@ -55,20 +244,22 @@
  * @param a The array of data points (MqsRawDataPoint_t) in which the peak is located.
  * @param size The size of the array.
  * @param peakIndex The index of the peak within the array.
+ * @param boundaries A pointer to store the nearest higher samples (or ends) on both sides, may be NULL.
+ * @param smoother The smoothing filter, or NULL for the raw phase angle.
  * @return The prominence of the specified peak.
  */
-static float findProminence(MqsRawDataPoint_t a[], int size, int peakIndex)
+static float findProminence(MqsRawDataPoint_t a[], int size, int peakIndex, MqsInterval_t *boundaries, const Smoother_t *smoother)
 {
     // Initialize variables to track the nearest higher peaks or ends
     int leftBoundary = 0;
     int rightBoundary = size - 1;
 
-    float peak_val = a[peakIndex].phaseAngle;
+    float peak_val = phaseAt(a, peakIndex, smoother);
 
     // Find the nearest higher peak or end on the left
     for (int i = peakIndex - 1; i >= 0; i--)
     {
-        if (a[i].phaseAngle > peak_val)
+        if (phaseAt(a, i, smoother) > peak_val)
         {
             leftBoundary = i;
             break;
@@ -78,7 +269,7 @@ static float findProminence(MqsRawDataPoint_t a[], int size, int peakIndex)
     // Find the nearest higher peak or end on the right
     for (int i = peakIndex + 1; i < size; i++)
     {
-        if (a[i].phaseAngle > peak_val)
+        if (phaseAt(a, i, smoother) > peak_val)
         {
             rightBoundary = i;
             break;
@@ -86,57 +277,80 @@ static float findProminence(MqsRawDataPoint_t a[], int size, int peakIndex)
     }
 
     // Find the minimum value within the boundaries
-    float minValue = a[rightBoundary].phaseAngle;
+    float minValue = phaseAt(a, rightBoundary, smoother);
     for (int i = leftBoundary; i <= rightBoundary; i++)
     {
-        if (a[i].phaseAngle < minValue)
+        float value = phaseAt(a, i, smoother);
+        if (value < minValue)
         {
-            minValue = a[i].phaseAngle;
+            minValue = value;
         }
     }
 
     // printf("min Value %f", minValue);
 
+    if (boundaries != NULL)
+    {
+        boundaries->left = leftBoundary;
+        boundaries->right = rightBoundary;
+    }
+
     // Calculate and return the prominence
     return peak_val - minValue;
 }
 
 /*!
- * @brief Finds the index of the maximum value in a column of a 2D array, ignoring specified indices.
+ * @brief Finds the index of the maximum value in a column of a 2D array, skipping excluded ranges.
+ *
+ * The array is scanned as a series of contiguous segments between the excluded intervals, so
+ * a skipped peak costs one jump rather than a test on every sample.
  *
  * @param a The array of data points (MqsRawDataPoint_t) to search through.
  * @param size The number of elements in the array.
  * @param col The column in the array to search for the maximum value.
  * @param max_val A pointer to store the maximum value found.
  * @param max_index A pointer to store the index of the maximum value.
- * @param ignoreIndices An array of indices to be ignored during the search.
- * @param numIgnoreIndices The number of indices to ignore.
+ * @param skipped Intervals of indices to be skipped during the search.
+ * @param numSkipped The number of intervals.
+ * @param smoother The smoothing filter, or NULL for the raw phase angle.
  * @return The index of the maximum value found in the specified column.
  */
-static int maxrow(MqsRawDataPoint_t a[], int size, int col, float *max_val, int *max_index, int ignoreIndices[], int numIgnoreIndices)
+static int maxrow(MqsRawDataPoint_t a[], int size, int col, float *max_val, int *max_index, const MqsInterval_t skipped[], int numSkipped, const Smoother_t *smoother)
 {
-    for (int i = 0; i < size; i++)
+    int i = 0;
+
+    while (i < size)
     {
-        // Skip the ignored indices
-        int ignore = 0;
-        for (int j = 0; j < numIgnoreIndices; j++)
+        // Jump past an interval covering i, otherwise find where the next one starts
+        int segmentEnd = size;
+        bool inside = false;
+        for (int j = 0; j < numSkipped; j++)
         {
-            if (i == ignoreIndices[j])
+            if (skipped[j].left <= i && i <= skipped[j].right)
             {
-                ignore = 1;
+                i = skipped[j].right + 1;
+                inside = true;
                 break;
             }
+            if (skipped[j].left > i && skipped[j].left < segmentEnd)
+            {
+                segmentEnd = skipped[j].left;
+            }
         }
 
-        if (ignore)
+        if (inside)
         {
             continue;
         }
 
-        if (*max_val < a[i].phaseAngle)
+        for (; i < segmentEnd; i++)
         {
-            *max_val = a[i].phaseAngle;
-            *max_index = i;
+            float value = phaseAt(a, i, smoother);
+            if (*max_val < value)
+            {
+                *max_val = value;
+                *max_index = i;
+            }
         }
     }
     return *max_index;
@@ -151,19 +365,20 @@ static int maxrow(MqsRawDataPoint_t a[], int size, int col, float *max_val, int
  * approach significantly reduces the time complexity compared to a linear search, improving 
  * performance, especially in large datasets.
  *
- * The function also supports ignoring specific indices in the dataset, which can be useful 
- * in cases where certain data points have low FWHM. 
+ * The function also supports skipping ranges of the dataset, which is used to exclude 
+ * peaks that were already rejected for their low FWHM. 
  *
  * @param a The array of data points (MqsRawDataPoint_t) to search through for a peak.
  * @param size The size of the array.
  * @param l The starting index of the current search window.
  * @param r The ending index of the current search window.
  * @param peakIndex A pointer to store the index of the found peak.
- * @param ignoreIndices An array of indices to be ignored during the search.
- * @param numIgnoreIndices The number of indices to ignore.
+ * @param skipped Intervals of indices to be skipped during the search.
+ * @param numSkipped The number of intervals.
+ * @param smoother The smoothing filter, or NULL for the raw phase angle.
  * @return The value of the peak found, or -1 if no peak is found.
  */
-static float findPeakRec(MqsRawDataPoint_t a[], int size, int l, int r, uint16_t *peakIndex, int ignoreIndices[], int numIgnoreIndices)
+static float findPeakRec(MqsRawDataPoint_t a[], int size, int l, int r, MqsIndex_t *peakIndex, const MqsInterval_t skipped[], int numSkipped, const Smoother_t *smoother)
 {
 
     if (l > r)
@@ -173,8 +388,8 @@ static float findPeakRec(MqsRawDataPoint_t a[], int size, int l, int r, uint16_t
     float max_val = 0.0f;
     int max_index = 0;
 
-    // Skip the ignored indices in the maxrow function
-    int max_row_index = maxrow(a, size, mid, &max_val, &max_index, ignoreIndices, numIgnoreIndices);
+    // Skip the excluded ranges in the maxrow function
+    int max_row_index = maxrow(a, size, mid, &max_val, &max_index, skipped, numSkipped, smoother);
 
     // printf("%f ", a[max_row_index].phaseAngle);
 
@@ -184,10 +399,10 @@ static float findPeakRec(MqsRawDataPoint_t a[], int size, int l, int r, uint16_t
         return max_val;
     }
 
-    if (max_val < a[mid - 1].phaseAngle)
-        return findPeakRec(a, size, l, mid - 1, peakIndex, ignoreIndices, numIgnoreIndices);
-    else if (max_val < a[mid + 1].phaseAngle)
-        return findPeakRec(a, size, mid + 1, r, peakIndex, ignoreIndices, numIgnoreIndices);
+    if (max_val < phaseAt(a, mid - 1, smoother))
+        return findPeakRec(a, size, l, mid - 1, peakIndex, skipped, numSkipped, smoother);
+    else if (max_val < phaseAt(a, mid + 1, smoother))
+        return findPeakRec(a, size, mid + 1, r, peakIndex, skipped, numSkipped, smoother);
     else
     {
         *peakIndex = max_row_index;
@@ -195,6 +410,213 @@ static float findPeakRec(MqsRawDataPoint_t a[], int size, int l, int r, uint16_t
     }
 }
 
+/*!
+ * @brief Finds the first sample at or below a threshold, scanning to the right.
+ *
+ * @param a The array of data points (MqsRawDataPoint_t) to search.
+ * @param first The first index to examine.
+ * @param last The last index to examine.
+ * @param threshold The height to compare against.
+ * @param smoother The smoothing filter, or NULL for the raw phase angle.
+ * @return The index of the first sample in [first, last] at or below the threshold, or -1.
+ */
+static int findCrossingRight(MqsRawDataPoint_t a[], int first, int last, float threshold, const Smoother_t *smoother)
+{
+    // Smoothed samples are computed one at a time, only raw samples are compared in blocks
+    if (smoother == NULL)
+    {
+        return scanPhaseRight(a, first, last, threshold, PHASE_AT_OR_BELOW);
+    }
+
+    for (int i = first; i <= last; i++)
+    {
+        if (phaseAt(a, i, smoother) <= threshold)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/*!
+ * @brief Finds the first sample at or below a threshold, scanning to the left.
+ *
+ * @param a The array of data points (MqsRawDataPoint_t) to search.
+ * @param first The first (highest) index to examine.
+ * @param last The last (lowest) index to examine.
+ * @param threshold The height to compare against.
+ * @param smoother The smoothing filter, or NULL for the raw phase angle.
+ * @return The index of the first sample in [last, first] at or below the threshold, or -1.
+ */
+static int findCrossingLeft(MqsRawDataPoint_t a[], int first, int last, float threshold, const Smoother_t *smoother)
+{
+    if (smoother == NULL)
+    {
+        return scanPhaseLeft(a, first, last, threshold, PHASE_AT_OR_BELOW);
+    }
+
+    for (int i = first; i >= last; i--)
+    {
+        if (phaseAt(a, i, smoother) <= threshold)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/*!
+ * @brief Locates the crossing of a threshold between two adjacent samples.
+ *
+ * The signal crosses the threshold between a[index] and a[index + 1]. With linear
+ * interpolation the crossing is where the straight line between the two samples meets the
+ * threshold. With cubic interpolation a Catmull-Rom spline through a[index - 1] .. a[index + 2]
+ * is used instead; it passes through both samples, so the crossing stays within the interval,
+ * and is solved by bisection starting from the linear bracket.
+ *
+ * @param a The array of data points (MqsRawDataPoint_t).
+ * @param size The size of the array.
+ * @param index The index of the sample on the left of the crossing.
+ * @param threshold The height whose crossing is located.
+ * @param interpolation The interpolation used between the samples.
+ * @param smoother The smoothing filter, or NULL for the raw phase angle.
+ * @return The fractional index of the crossing.
+ */
+static float interpolateCrossing(MqsRawDataPoint_t a[], int size, int index, float threshold, MqsInterpolation_t interpolation, const Smoother_t *smoother)
+{
+    float y1 = phaseAt(a, index, smoother);
+    float y2 = phaseAt(a, index + 1, smoother);
+    float dy = y2 - y1;
+
+    if (dy == 0.0f)
+    {
+        return (float)index;
+    }
+
+    float t = (threshold - y1) / dy;
+
+    if (interpolation == MQS_INTERP_CUBIC)
+    {
+        float y0 = (index > 0) ? phaseAt(a, index - 1, smoother) : 2.0f * y1 - y2;
+        float y3 = (index + 2 < size) ? phaseAt(a, index + 2, smoother) : 2.0f * y2 - y1;
+
+        // Catmull-Rom coefficients of y(t) = c0 + c1 t + c2 t^2 + c3 t^3 on [0, 1]
+        float c0 = y1;
+        float c1 = 0.5f * (y2 - y0);
+        float c2 = y0 - 2.5f * y1 + 2.0f * y2 - 0.5f * y3;
+        float c3 = 0.5f * (y3 - y0) + 1.5f * (y1 - y2);
+
+        float lo = 0.0f;
+        float hi = 1.0f;
+        float sign = (dy > 0.0f) ? 1.0f : -1.0f;
+        for (int it = 0; it < 20; it++)
+        {
+            float mid = 0.5f * (lo + hi);
+            float y = c0 + mid * (c1 + mid * (c2 + mid * c3));
+            if (sign * (y - threshold) < 0.0f)
+            {
+                lo = mid;
+            }
+            else
+            {
+                hi = mid;
+            }
+        }
+        t = 0.5f * (lo + hi);
+    }
+
+    if (t < 0.0f)
+    {
+        t = 0.0f;
+    }
+    else if (t > 1.0f)
+    {
+        t = 1.0f;
+    }
+    return (float)index + t;
+}
+
+/*!
+ * @brief Refines the location and height of a peak between samples.
+ *
+ * Fits a parabola through the peak sample and its two neighbours and returns its vertex.
+ * With Gaussian refinement the parabola is fitted to the logarithms of the samples, which
+ * is exact for a Gaussian peak; it falls back to the parabolic fit if a sample is not
+ * positive. Peaks on the first or last sample are not refined.
+ *
+ * @param a The array of data points (MqsRawDataPoint_t) containing the peak.
+ * @param size The size of the array.
+ * @param peakIndex The index of the peak within the array.
+ * @param refinement The model used for the refinement.
+ * @param apexValue A pointer to store the height of the refined apex.
+ * @param smoother The smoothing filter, or NULL for the raw phase angle.
+ * @return The fractional index of the refined apex.
+ */
+static float refineApex(MqsRawDataPoint_t a[], int size, int peakIndex, MqsApexRefinement_t refinement, float *apexValue, const Smoother_t *smoother)
+{
+    float ym = (peakIndex > 0) ? phaseAt(a, peakIndex - 1, smoother) : 0.0f;
+    float y0 = phaseAt(a, peakIndex, smoother);
+    float yp = (peakIndex < size - 1) ? phaseAt(a, peakIndex + 1, smoother) : 0.0f;
+
+    *apexValue = y0;
+    if (peakIndex <= 0 || peakIndex >= size - 1)
+    {
+        return (float)peakIndex;
+    }
+
+    bool gaussian = refinement == MQS_APEX_GAUSSIAN && ym > 0.0f && y0 > 0.0f && yp > 0.0f;
+    if (gaussian)
+    {
+        ym = logf(ym);
+        y0 = logf(y0);
+        yp = logf(yp);
+    }
+
+    float denominator = ym - 2.0f * y0 + yp;
+    if (denominator >= 0.0f)
+    {
+        // Not a local maximum of the fitted curve, keep the sample
+        return (float)peakIndex;
+    }
+
+    float delta = 0.5f * (ym - yp) / denominator;
+    if (delta < -0.5f)
+    {
+        delta = -0.5f;
+    }
+    else if (delta > 0.5f)
+    {
+        delta = 0.5f;
+    }
+
+    float vertex = y0 - 0.25f * (ym - yp) * delta;
+    *apexValue = gaussian ? expf(vertex) : vertex;
+    return (float)peakIndex + delta;
+}
+
+/*!
+ * @brief Calculates the sharpness of a peak, the second difference of the phase angle at its sample.
+ *
+ * @param a The array of data points (MqsRawDataPoint_t) containing the peak.
+ * @param size The size of the array.
+ * @param peakIndex The index of the peak within the array.
+ * @param smoother The smoothing filter, or NULL for the raw phase angle.
+ * @return a[peakIndex - 1] - 2 a[peakIndex] + a[peakIndex + 1], negative at a maximum, or 0
+ *         if the peak sits on the first or last sample.
+ */
+static float calculateSharpness(MqsRawDataPoint_t a[], int size, int peakIndex, const Smoother_t *smoother)
+{
+    if (peakIndex < 1 || peakIndex > size - 2)
+    {
+        return 0.0f;
+    }
+
+    float left = phaseAt(a, peakIndex - 1, smoother);
+    float centre = phaseAt(a, peakIndex, smoother);
+    float right = phaseAt(a, peakIndex + 1, smoother);
+    return left - 2.0f * centre + right;
+}
+
 /*!
  * @brief Calculates the Full Width at Half Maximum (FWHM) of a peak in a dataset.
  *
@@ -208,46 +630,136 @@ static float findPeakRec(MqsRawDataPoint_t a[], int size, int l, int r, uint16_t
  * the signal crosses this half-prominence height. The FWHM is determined as the distance 
  * between these two indices.
  *
- * Special consideration is given in cases where the signal does not exactly cross the 
- * half-prominence height at a data point, by interpolating between points if necessary.
+ * Since the signal rarely crosses the half-prominence height exactly at a data point, the
+ * crossings are also located between samples (see interpolateCrossing) and the distance
+ * between them is reported as the interpolated FWHM.
  * for more information: // https://www.mathworks.com/help/signal/ref/findpeaks.html#buhd6xj
  *
  * @param a The array of data points (MqsRawDataPoint_t) containing the peak.
  * @param size The size of the array.
  * @param peakIndex The index of the peak within the array.
  * @param prominence The prominence of the peak, used to determine the half-prominence height.
- * @return The FWHM of the specified peak, calculated based on half the prominence.
+ * @param interpolation The interpolation used between the samples around each crossing.
+ * @param leftCrossing A pointer to store the fractional index of the left crossing.
+ * @param rightCrossing A pointer to store the fractional index of the right crossing.
+ * @param crossingIndices A pointer to store the sample indices of both crossings.
+ * @param smoother The smoothing filter, or NULL for the raw phase angle.
+ * @return The FWHM of the specified peak in whole samples, calculated based on half the prominence.
  */
-static int calculateFWHM(MqsRawDataPoint_t a[], int size, int peakIndex, float prominence)
+static int calculateFWHM(MqsRawDataPoint_t a[], int size, int peakIndex, float prominence,
+                         MqsInterpolation_t interpolation, float *leftCrossing, float *rightCrossing,
+                         MqsInterval_t *crossingIndices, const Smoother_t *smoother)
 {
     // First, find the base of the peak
-    float peakHeight = a[peakIndex].phaseAngle;
+    float peakHeight = phaseAt(a, peakIndex, smoother);
     float contourLineHeight = peakHeight - prominence;
 
     // The height at which we measure the FWHM is half the prominence above the contour line
     float halfProminenceHeight = contourLineHeight + (prominence / 2.0f);
 
-    // Find the left and right indices where the phase angle crosses the half-prominence height
-    int leftIndex = peakIndex;
-    while (leftIndex > 0 && a[leftIndex].phaseAngle > halfProminenceHeight)
+    // Find the left and right indices where the phase angle crosses the half-prominence height,
+    // falling back to the ends of the array if it never does
+    int leftIndex = findCrossingLeft(a, peakIndex, 1, halfProminenceHeight, smoother);
+    if (leftIndex < 0)
     {
-        leftIndex--;
+        leftIndex = 0;
+        *leftCrossing = 0.0f;
+    }
+    else
+    {
+        *leftCrossing = interpolateCrossing(a, size, leftIndex, halfProminenceHeight, interpolation, smoother);
     }
 
-    int rightIndex = peakIndex;
-    while (rightIndex < size - 1 && a[rightIndex].phaseAngle > halfProminenceHeight)
+    int rightIndex = findCrossingRight(a, peakIndex, size - 2, halfProminenceHeight, smoother);
+    if (rightIndex < 0)
     {
-        rightIndex++;
+        rightIndex = size - 1;
+        *rightCrossing = (float)rightIndex;
     }
+    else
+    {
+        *rightCrossing = interpolateCrossing(a, size, rightIndex - 1, halfProminenceHeight, interpolation, smoother);
+    }
+
+    crossingIndices->left = leftIndex;
+    crossingIndices->right = rightIndex;
 
     // Calculate FWHM using the phase angles at left and right indices
-    // Be sure to handle the cases where the signal doesn't cross the half-prominence height
-    // at a data point exactly by interpolating between points if necessary
     int fwhm = fabsf(rightIndex - leftIndex);
 
     return fwhm;
 }
 
+/*!
+ * @brief Determines the extent of a rejected peak, to exclude it from further searches.
+ *
+ * Starting from the samples at the half-height crossings, each flank is followed outward as long as the
+ * signal keeps descending, down to the base of the peak on that side. The walk never passes
+ * the nearest higher samples found by the prominence calculation, so a tall narrow glitch
+ * does not swallow the neighbouring peaks it towers over.
+ *
+ * @param a The array of data points (MqsRawDataPoint_t) containing the peak.
+ * @param crossingIndices The sample indices of the half-height crossings.
+ * @param boundaries The nearest higher samples (or ends) on both sides of the peak.
+ * @param smoother The smoothing filter, or NULL for the raw phase angle.
+ * @return The interval from the left base to the right base of the peak.
+ */
+static MqsInterval_t findPeakExtent(MqsRawDataPoint_t a[], MqsInterval_t crossingIndices, MqsInterval_t boundaries, const Smoother_t *smoother)
+{
+    MqsInterval_t extent;
+    int left = crossingIndices.left;
+    int right = crossingIndices.right;
+
+    while (left > boundaries.left && phaseAt(a, left - 1, smoother) <= phaseAt(a, left, smoother))
+    {
+        left--;
+    }
+    while (right < boundaries.right && phaseAt(a, right + 1, smoother) <= phaseAt(a, right, smoother))
+    {
+        right++;
+    }
+
+    extent.left = left;
+    extent.right = right;
+    return extent;
+}
+
+/*!
+ * @brief Counts the samples between first and last that do not keep rising towards one end.
+ *
+ * The derivative at sample i is taken towards the end the walk is heading for, i.e. towards
+ * i + 1 for the right end and i - 1 for the left one. Every failure is counted instead of
+ * stopping at the second, which gives the same classification without a branch, so the raw
+ * loop vectorises.
+ *
+ * @param a The array of data points (MqsRawDataPoint_t).
+ * @param first The first sample to test.
+ * @param last The last sample to test.
+ * @param direction 1 towards the right end, -1 towards the left end.
+ * @param noiseTolerance The tolerance level for the derivative to be considered noise.
+ * @param smoother The smoothing filter, or NULL for the raw phase angle.
+ * @return The number of derivatives less than or equal to the noise tolerance.
+ */
+static int countEdgeFailures(MqsRawDataPoint_t a[], int first, int last, int direction, float noiseTolerance, const Smoother_t *smoother)
+{
+    int failCount = 0;
+
+    if (smoother == NULL)
+    {
+        for (int i = first; i <= last; i++)
+        {
+            failCount += (a[i + direction].phaseAngle - a[i].phaseAngle <= noiseTolerance);
+        }
+        return failCount;
+    }
+
+    for (int i = first; i <= last; i++)
+    {
+        failCount += (phaseAt(a, i + direction, smoother) - phaseAt(a, i, smoother) <= noiseTolerance);
+    }
+    return failCount;
+}
+
 /*!
  * @brief Determines if a peak is still climbing at the end of a dataset.
  *
@@ -270,126 +782,244 @@ static int calculateFWHM(MqsRawDataPoint_t a[], int size, int peakIndex, float p
  * @param sizeB The size of the array.
  * @param peakIndex The index of the peak within the array.
  * @param noiseTolerance The tolerance level for the derivative to be considered noise.
+ * @param smoother The smoothing filter, or NULL for the raw phase angle.
  * @return True if the peak is still climbing; false otherwise.
  */
-static bool isPeakClimbing(MqsRawDataPoint_t b[], int sizeB, int peakIndex, float noiseTolerance)
+static bool isPeakClimbing(MqsRawDataPoint_t b[], int sizeB, int peakIndex, float noiseTolerance, const Smoother_t *smoother)
 {
     if (peakIndex <= 0 || peakIndex >= sizeB - 1)
     {
         return false; 
     }
 
-    int failCount = 0; // Counter for the number of times condition is not met
+    // Not climbing if the condition failed at least twice
+    return countEdgeFailures(b, peakIndex, sizeB - 2, 1, noiseTolerance, smoother) < 2;
+}
 
-    for (int i = peakIndex; i < sizeB - 1; i++)
+/*!
+ * @brief Determines if a peak is still falling from the start of a dataset.
+ *
+ * Mirror image of isPeakClimbing: walking from the peak index back to the first sample,
+ * the peak continues into the previous dataset if fewer than two derivatives towards the
+ * start are less than or equal to the noise tolerance.
+ *
+ * @param b The array of data points (MqsRawDataPoint_t) containing the peak.
+ * @param sizeB The size of the array.
+ * @param peakIndex The index of the peak within the array.
+ * @param noiseTolerance The tolerance level for the derivative to be considered noise.
+ * @param smoother The smoothing filter, or NULL for the raw phase angle.
+ * @return True if the peak is still falling from the start; false otherwise.
+ */
+static bool isPeakFalling(MqsRawDataPoint_t b[], int sizeB, int peakIndex, float noiseTolerance, const Smoother_t *smoother)
+{
+    if (peakIndex <= 0 || peakIndex >= sizeB - 1)
     {
-        float derivativeAfter = b[i + 1].phaseAngle - b[i].phaseAngle;
-
-        // Check if the derivative after is less than or equal to the noise tolerance
-        if (derivativeAfter <= noiseTolerance)
-        {
-            failCount++; 
-            if (failCount >= 2) // Check if it's the second time
-            {
-                return false; // Peak is not climbing if condition failed twice
-            }
-        }
+        return false;
     }
 
-    // Return true only if failCount is less than 2
-    return failCount < 2; 
+    return countEdgeFailures(b, 1, peakIndex, -1, noiseTolerance, smoother) < 2;
 }
 
-/*
-float calculateDampingRatio(float resonanceFrequency, float FWHM) {
-    float dampingRatio = resonanceFrequency / (2 * M_PI * FWHM);
-    return dampingRatio;
-}
+/*!
+ * @brief Returns the workspace size needed by processPeakDetailed.
+ *
+ * @param size The size of the arrays that will be processed.
+ * @param config The configuration that will be used, or NULL for the defaults.
+ * @return The number of workspace bytes, 0 if no workspace is needed.
+ */
+size_t processPeakWorkspaceSize(int size, const MqsPeakConfig_t *config)
+{
+    size_t bytes = 0;
+
+    // The default pipeline works entirely on the stack; the optional stages run one after
+    // the other and release their tables, so the largest one sets the size
+    if (config != NULL && config->despikeHalfWindow > 0)
+    {
+        bytes = hampelWorkspaceSize(config->despikeHalfWindow);
+    }
+    if (config != NULL && config->noise != NULL && noiseWorkspaceSize(size) > bytes)
+    {
+        bytes = noiseWorkspaceSize(size);
+    }
 
-double lorentzian(double frequency, double peakHeight, double resonanceFrequency, double halfWidthAtHalfMaximum) {
-    return (peakHeight / M_PI) * (halfWidthAtHalfMaximum / (pow(frequency - resonanceFrequency, 2) + pow(halfWidthAtHalfMaximum, 2)));
+    // The replaced indices are held below the stage tables until the detector returns
+    if (config != NULL && config->despikeHalfWindow > 0)
+    {
+        bytes += WORKSPACE_BYTES(size, MqsIndex_t);
+    }
+    return (bytes > 0) ? bytes + WORKSPACE_ALIGNMENT : 0;
 }
-*/
 
 /*!
- * @brief Processes and validates a peak within a dataset.
- *
- * This function identifies and validates a peak in a given dataset. The peak is first identified
- * using a recursive peak-finding algorithm. Once found, the function calculates the peak's
- * prominence and Full Width at Half Maximum (FWHM) to determine its significance and breadth.
- *
- * The peak is considered valid if:
- *   - The prominence exceeds a specified threshold, indicating it is a significant peak.
- *   - The FWHM is greater than a certain value, ensuring the peak is not too narrow.
- *
- * Additionally, if the peak is near the end of the dataset, the function checks if the peak is 
- * still climbing, indicating that it might continue in the next dataset. This is determined using 
- * the `isPeakClimbing` function.
- *
- * If the peak does not meet these criteria, it is skipped, and the function attempts to find 
- * another peak, up to a maximum number of attempts. Peaks that are skipped are recorded in an 
- * array to prevent reprocessing in subsequent attempts.
+ * @brief Detection pipeline behind processPeakDetailed.
  *
  * @param a The array of data points (MqsRawDataPoint_t) containing the potential peak.
  * @param size The size of the array.
- * @param peakIndex A pointer to store the index of the identified peak.
- * @param isEdgeCase A pointer to a boolean flag indicating if the peak is an edge case.
+ * @param config Interpolation and smoothing options, or NULL for the defaults.
+ * @param workspace Scratch memory of at least processPeakWorkspaceSize bytes.
+ * @param result A pointer to the structure receiving the description of the peak.
+ * @param peakBounds Output, the nearest higher samples (or ends) around the last candidate, the
+ *                   whole sweep if there was none; may be NULL.
  * @return True if a valid peak is found and processed; false otherwise.
  */
-bool processPeak(MqsRawDataPoint_t a[], int size, uint16_t *peakIndex, bool* isEdgeCase)
+static bool detectPeak(MqsRawDataPoint_t a[], int size, const MqsPeakConfig_t *config, MqsWorkspace_t *workspace,
+                       MqsPeakResult_t *result, MqsInterval_t *peakBounds)
 {
-    int skippedIndices[3]; // Array to store the indices of skipped peaks
-    int skippedCount = 0;  // Count of skipped peaks
-    int maxAttempts = 3;   // Maximum number of attempts
+    static const MqsPeakConfig_t defaultConfig = { MQS_INTERP_LINEAR, MQS_APEX_PARABOLIC, MQS_SMOOTH_NONE, 0, 0, 0.0f, 0, 0.0f, 0.0f, NULL, NULL, 0.0f, 0.0f };
+    MqsIndex_t *peakIndex = &result->peakIndex;
+    MqsInterval_t skippedRanges[MAX_PEAK_ATTEMPTS]; // Extents of the skipped peaks
+    int skippedCount = 0;                           // Count of skipped peaks
+    int maxAttempts = MAX_PEAK_ATTEMPTS;   // Maximum number of attempts
     int fwhm = 0;
     int retry = 0;
 
+    if (config == NULL)
+    {
+        config = &defaultConfig;
+    }
+
+    // Phase jumps of wrapped front ends would otherwise be taken for peaks
+    if (config->unwrapPeriod > 0.0f)
+    {
+        MqsPhaseUnwrap_t unwrap;
+        phaseUnwrapInit(&unwrap, config->unwrapPeriod);
+        phaseUnwrap(&unwrap, a, size);
+    }
+
+    // Every table carved out of the workspace is released on return
+    size_t workspaceStart = workspaceMark(workspace);
+    bool accepted = false;
+
+    *result = (MqsPeakResult_t){ 0 };
+    if (peakBounds != NULL)
+    {
+        *peakBounds = (MqsInterval_t){ 0, size - 1 };
+    }
+
+#ifdef MES_INDEX_16BIT
+    // The indices of longer sweeps would not fit the result
+    if (size - 1 > MES_INDEX_MAX)
+    {
+        printf("Sweep too long for 16-bit indices.\n");
+        return false;
+    }
+#endif
+
+    // Glitches would otherwise be found, and rejected as too narrow, one attempt at a time
+    if (config->despikeHalfWindow > 0)
+    {
+        MqsHampelConfig_t hampelConfig = { config->despikeHalfWindow, config->despikeSigma, config->despikeMinDeviation };
+        MqsHampel_t hampel;
+        MqsIndex_t *despiked = workspaceAlloc(workspace, (size_t)size * sizeof(MqsIndex_t));
+        size_t hampelStart = workspaceMark(workspace);
+        if (despiked == NULL || !hampelInit(&hampel, &hampelConfig, workspace))
+        {
+            printf("Workspace too small for the Hampel filter.\n");
+            workspaceRelease(workspace, workspaceStart);
+            return false;
+        }
+        result->despikedCount = hampelFilter(&hampel, a, size, despiked, size);
+        result->despikedIndices = despiked;
+        workspaceRelease(workspace, hampelStart);
+    }
+
+    // The drift would otherwise add to the prominence; the cached fit is refreshed as due
+    if (config->baseline != NULL && !baselineUpdate(config->baseline, a, size))
+    {
+        printf("Baseline fit failed.\n");
+    }
+
+    // Thresholds in units of the channel's noise hold across hardware whose noise differs
+    float minProminence = MIN_PEAK_PROMINENCE;
+    float noiseTolerance = NOISE_TOLERANCE;
+    if (config->noise != NULL)
+    {
+        if (!noiseUpdate(config->noise, a, size, workspace))
+        {
+            printf("Workspace too small for the noise estimate.\n");
+        }
+        if (config->noise->sweeps > 0)
+        {
+            result->noiseSigma = config->noise->sigma;
+            minProminence = (config->prominenceSigma > 0.0f) ? config->prominenceSigma * config->noise->sigma : minProminence;
+            noiseTolerance = (config->noiseToleranceSigma > 0.0f) ? config->noiseToleranceSigma * config->noise->sigma : noiseTolerance;
+        }
+    }
+
+    // The smoothed and detrended sweep is never stored, every stage filters the samples it reads
+    Smoother_t smootherState;
+    const Smoother_t *smoother = initSmoother(config, size, &smootherState);
+
     do
     {
-        float peakValue = findPeakRec(a, size, 0, size - 1, peakIndex, skippedIndices, skippedCount);
+        float peakValue = findPeakRec(a, size, 0, size - 1, peakIndex, skippedRanges, skippedCount, smoother);
 
         if (peakValue == -1)
         {
             printf("No peak found.\n");
-            return false;
+            break;
         }
 
         printf("\nPeak: %f\n", peakValue);
-        printf("Index: %d\n", *peakIndex);
+        printf("Index: %lu\n", (unsigned long)*peakIndex);
 
         // Check prominence
-        float prominence = findProminence(a, size - 1, *peakIndex);
+        MqsInterval_t boundaries;
+        float prominence = findProminence(a, size - 1, *peakIndex, &boundaries, smoother);
         printf("Prominence: %f\n", prominence);
+        if (peakBounds != NULL)
+        {
+            *peakBounds = boundaries;
+        }
+
+        result->peakValue = peakValue;
+        result->prominence = prominence;
 
-        if (prominence > 18.0f)
+        if (prominence > minProminence)
         {
+            result->sharpness = calculateSharpness(a, size, *peakIndex, smoother);
+
             // Check FWHM
-            fwhm = calculateFWHM(a, size, *peakIndex, prominence);
+            MqsInterval_t crossingIndices;
+            fwhm = calculateFWHM(a, size, *peakIndex, prominence, config->interpolation,
+                                 &result->leftCrossing, &result->rightCrossing, &crossingIndices, smoother);
             printf("FWHM: %d\n", fwhm);
 
-            // Check if peak is near the end and potentially still climaxing
-            if (*peakIndex >= size - PEAK_THRESHOLD)
+            result->fwhm = fwhm;
+            result->fwhmInterpolated = result->rightCrossing - result->leftCrossing;
+            result->apexPosition = refineApex(a, size, *peakIndex, config->apexRefinement, &result->apexValue, smoother);
+
+            // Check if peak is near either end and potentially continues in the neighbouring segment
+            int edge = MQS_EDGE_NONE;
+            if ((int)*peakIndex >= size - PEAK_THRESHOLD && isPeakClimbing(a, size, *peakIndex, noiseTolerance, smoother))
+            {
+                edge |= MQS_EDGE_RIGHT;
+            }
+            if ((int)*peakIndex < PEAK_THRESHOLD && isPeakFalling(a, size, *peakIndex, noiseTolerance, smoother))
             {
-                *isEdgeCase = isPeakClimbing(a, size, *peakIndex, NOISE_TOLERANCE);
+                edge |= MQS_EDGE_LEFT;
             }
+            result->isEdgeCase = (edge & MQS_EDGE_RIGHT) != 0;
+            result->truncatedEdge = (MqsEdge_t)edge;
 
-            if (fwhm > 15) 
+            if (fwhm > MIN_PEAK_FWHM)
             {
-                return true; // Peak accepted
+                accepted = true; // Peak accepted
+                break;
             }
             else
             {
                 printf("FWHM is less than 15.0. Retrying...\n");
-                // Store the index of the skipped peak
-                if (skippedCount < 3)
+                // Store the extent of the skipped peak
+                if (skippedCount < MAX_PEAK_ATTEMPTS)
                 {
-                    skippedIndices[skippedCount++] = *peakIndex;
+                    skippedRanges[skippedCount++] = findPeakExtent(a, crossingIndices, boundaries, smoother);
                 }
             }
         }
         else
         {
-            printf("Prominence < 18.0.\n");
+            printf("Prominence < %.1f.\n", minProminence);
             // Exit the loop if the prominence is less than 14.0
             break;
         }
@@ -397,11 +1027,266 @@ bool processPeak(MqsRawDataPoint_t a[], int size, uint16_t *peakIndex, bool* isE
         retry++;
     } while (retry < maxAttempts);
 
-    return false;
+    workspaceRelease(workspace, workspaceStart);
+    return accepted;
+}
+
+/*!
+ * @brief Processes and validates a peak within a dataset.
+ *
+ * This function identifies and validates a peak in a given dataset. The peak is first identified
+ * using a recursive peak-finding algorithm. Once found, the function calculates the peak's
+ * prominence and Full Width at Half Maximum (FWHM) to determine its significance and breadth.
+ *
+ * The peak is considered valid if:
+ *   - The prominence exceeds a specified threshold, indicating it is a significant peak.
+ *   - The FWHM is greater than a certain value, ensuring the peak is not too narrow.
+ *
+ * Additionally, if the peak is near the end of the dataset, the function checks if the peak is 
+ * still climbing, indicating that it might continue in the next dataset. This is determined using 
+ * the `isPeakClimbing` function. Symmetrically, a peak near the start that is still falling from
+ * the first sample is found by `isPeakFalling`; `truncatedEdge` reports which ends are affected.
+ *
+ * If the peak does not meet these criteria, it is skipped, and the function attempts to find 
+ * another peak, up to a maximum number of attempts. The whole extent of a skipped peak, from 
+ * its left base to its right base, is recorded so that subsequent attempts cannot land on 
+ * the neighbouring samples of the same peak.
+ *
+ * Besides the integer peak index and FWHM used by the acceptance criteria, the result holds
+ * the FWHM between interpolated half-height crossings and the apex refined between samples,
+ * so widths finer than the sample spacing can be resolved.
+ *
+ * @param a The array of data points (MqsRawDataPoint_t) containing the potential peak.
+ * @param size The size of the array.
+ * @param config Interpolation and smoothing options, or NULL for linear crossings, a parabolic
+ *               apex and no smoothing.
+ * @param workspace Scratch memory of at least processPeakWorkspaceSize bytes, may be NULL if
+ *                  that size is 0.
+ * @param result A pointer to the structure receiving the description of the peak.
+ * @return True if a valid peak is found and processed; false otherwise.
+ */
+bool processPeakDetailed(MqsRawDataPoint_t a[], int size, const MqsPeakConfig_t *config, MqsWorkspace_t *workspace, MqsPeakResult_t *result)
+{
+    return detectPeak(a, size, config, workspace, result, NULL);
+}
+
+/*!
+ * @brief Locates the half-prominence crossing of an impedance minimum on one side.
+ *
+ * Walks from the minimum in the given direction to the first sample at or above the
+ * threshold and interpolates linearly between it and the previous sample.
+ *
+ * @param a The array of data points (MqsRawDataPoint_t).
+ * @param bounds The window the walk stays in.
+ * @param minIndex The index of the impedance minimum.
+ * @param direction -1 to walk to the left, 1 to walk to the right.
+ * @param threshold The impedance at half prominence above the minimum.
+ * @return The fractional index of the crossing, or the end of the window if there is none.
+ */
+static float findImpedanceCrossing(MqsRawDataPoint_t a[], MqsInterval_t bounds, int minIndex, int direction, float threshold)
+{
+    for (int i = minIndex + direction; i >= bounds.left && i <= bounds.right; i += direction)
+    {
+        if (a[i].impedance >= threshold)
+        {
+            float inner = a[i - direction].impedance;
+            float t = (threshold - inner) / (a[i].impedance - inner);
+            return (float)(i - direction) + (float)direction * t;
+        }
+    }
+    return (float)((direction < 0) ? bounds.left : bounds.right);
+}
+
+/*!
+ * @brief Analyses the phase angle and the impedance of a sweep together.
+ *
+ * The phase peak is detected by the regular pipeline, which scans the prepared phase angle
+ * once for its maximum; no separate scan of the raw sweep is made, so the candidate is also
+ * valid when the sweep is unwrapped, despiked, detrended or smoothed. The impedance is then
+ * only examined between the prominence boundaries of the phase peak, the nearest higher
+ * phase samples on either side: one pass over that window finds the impedance minimum and
+ * the highest impedance on each side of it. The depth is measured from the higher side, the
+ * prominence from the lower one, and the width between the interpolated crossings at half
+ * prominence, so a deeper minimum of another resonance elsewhere in the sweep does not
+ * interfere.
+ *
+ * For a resonator the impedance minimum (series resonance) lies on the flank of the phase
+ * peak, so the pair is reported as consistent when the minimum falls within the half-height
+ * crossings of the accepted phase peak.
+ *
+ * @param a The array of data points (MqsRawDataPoint_t).
+ * @param size The size of the array.
+ * @param config Interpolation and smoothing options for the phase channel, or NULL for the defaults.
+ * @param workspace Scratch memory of at least processPeakWorkspaceSize bytes, may be NULL if
+ *                  that size is 0.
+ * @param result A pointer to the structure receiving both channels.
+ * @return True if the phase peak is accepted and consistent with the impedance minimum; false otherwise.
+ */
+bool processPeakDualChannel(MqsRawDataPoint_t a[], int size, const MqsPeakConfig_t *config, MqsWorkspace_t *workspace, MqsDualPeakResult_t *result)
+{
+    *result = (MqsDualPeakResult_t){ 0 };
+    if (size <= 0)
+    {
+        return false;
+    }
+
+    MqsInterval_t bounds;
+    result->phaseAccepted = detectPeak(a, size, config, workspace, &result->phase, &bounds);
+
+    // Highest impedance left of the running minimum, and right of it up to the current sample
+    float impedanceMin = a[bounds.left].impedance;
+    int impedanceIndex = bounds.left;
+    float prefixMax = impedanceMin;
+    float leftMax = impedanceMin;
+    float rightMax = impedanceMin;
+
+    for (int i = bounds.left + 1; i <= bounds.right; i++)
+    {
+        float z = a[i].impedance;
+        prefixMax = (z > prefixMax) ? z : prefixMax;
+        if (z < impedanceMin)
+        {
+            impedanceMin = z;
+            impedanceIndex = i;
+            leftMax = prefixMax;
+            rightMax = z;
+        }
+        else
+        {
+            rightMax = (z > rightMax) ? z : rightMax;
+        }
+    }
+
+    float highest = (leftMax > rightMax) ? leftMax : rightMax;
+    float lowerSide = (leftMax < rightMax) ? leftMax : rightMax;
+    float prominence = lowerSide - impedanceMin;
+    float halfProminence = impedanceMin + prominence / 2.0f;
+    result->impedanceIndex = (MqsIndex_t)impedanceIndex;
+    result->impedanceValue = impedanceMin;
+    result->impedanceDepth = highest - impedanceMin;
+    result->impedanceProminence = prominence;
+    result->impedanceWidth = (prominence > 0.0f) ? findImpedanceCrossing(a, bounds, impedanceIndex, 1, halfProminence) -
+                                                   findImpedanceCrossing(a, bounds, impedanceIndex, -1, halfProminence) : 0.0f;
+    result->frequencyOffset = (float)impedanceIndex - result->phase.apexPosition;
+
+    result->isConsistent = result->phaseAccepted &&
+                           (float)impedanceIndex >= result->phase.leftCrossing &&
+                           (float)impedanceIndex <= result->phase.rightCrossing;
+    printf("Impedance minimum: %f at %d, offset %f\n", impedanceMin, impedanceIndex, result->frequencyOffset);
+
+    return result->isConsistent;
+}
+
+/*!
+ * @brief Finds the best qualifying peak in each of several index windows (bands).
+ *
+ * Each band is processed as a view into the original array, so the search, prominence, FWHM
+ * and climbing check only see the samples of that band and treat its ends as the ends of the
+ * data. No sub-array is copied; the indices of the results are shifted back to the full array.
+ *
+ * @param a The array of data points (MqsRawDataPoint_t).
+ * @param size The size of the array.
+ * @param bands The index windows to search, clipped to the array.
+ * @param numBands The number of bands.
+ * @param config Interpolation options, or NULL for the defaults.
+ * @param workspace Scratch memory of at least processPeakWorkspaceSize bytes for the longest band.
+ * @param results Caller-owned array of numBands results.
+ * @param accepted Caller-owned array of numBands flags, true if the band holds a valid peak.
+ * @return The number of bands with a valid peak.
+ */
+int processPeakBands(MqsRawDataPoint_t a[], int size, const MqsInterval_t bands[], int numBands,
+                     const MqsPeakConfig_t *config, MqsWorkspace_t *workspace, MqsPeakResult_t results[], bool accepted[])
+{
+    size_t workspaceStart = workspaceMark(workspace);
+    int numAccepted = 0;
+
+    for (int n = 0; n < numBands; n++)
+    {
+        int left = (bands[n].left > 0) ? bands[n].left : 0;
+        int right = (bands[n].right < size - 1) ? bands[n].right : size - 1;
+
+        results[n] = (MqsPeakResult_t){ 0 };
+        accepted[n] = false;
+        if (left > right)
+        {
+            continue;
+        }
+
+#ifdef MES_INDEX_16BIT
+        // Indices of the full array beyond the band start would not fit the result
+        if (right > MES_INDEX_MAX)
+        {
+            printf("Band too far into the sweep for 16-bit indices.\n");
+            continue;
+        }
+#endif
+
+        // Every band has its own baseline and noise history, the caches are per band
+        const MqsPeakConfig_t *bandConfig = config;
+        MqsPeakConfig_t bandCaches;
+        if (config != NULL && (config->baseline != NULL || config->noise != NULL))
+        {
+            bandCaches = *config;
+            bandCaches.baseline = (config->baseline != NULL) ? &config->baseline[n] : NULL;
+            bandCaches.noise = (config->noise != NULL) ? &config->noise[n] : NULL;
+            bandConfig = &bandCaches;
+        }
+
+        accepted[n] = processPeakDetailed(&a[left], right - left + 1, bandConfig, workspace, &results[n]);
+
+        // The replaced indices were released with the band's tables; keep them past the next band
+        if (results[n].despikedIndices != NULL)
+        {
+            MqsIndex_t *despiked = workspaceAlloc(workspace, (size_t)results[n].despikedCount * sizeof(MqsIndex_t));
+            if (despiked != NULL)
+            {
+                memmove(despiked, results[n].despikedIndices, (size_t)results[n].despikedCount * sizeof(MqsIndex_t));
+                for (int k = 0; k < results[n].despikedCount; k++)
+                {
+                    despiked[k] += (MqsIndex_t)left;
+                }
+            }
+            results[n].despikedIndices = despiked;
+        }
+
+        // Back to indices of the full array
+        results[n].peakIndex += left;
+        results[n].leftCrossing += left;
+        results[n].rightCrossing += left;
+        results[n].apexPosition += left;
+
+        numAccepted += accepted[n];
+    }
+
+    workspaceRelease(workspace, workspaceStart);
+    return numAccepted;
+}
+
+/*!
+ * @brief Processes and validates a peak within a dataset.
+ *
+ * Thin wrapper around processPeakDetailed that only reports the peak index and the edge
+ * case flag.
+ *
+ * @param a The array of data points (MqsRawDataPoint_t) containing the potential peak.
+ * @param size The size of the array.
+ * @param peakIndex A pointer to store the index of the identified peak.
+ * @param isEdgeCase A pointer to a boolean flag indicating if the peak is an edge case.
+ * @return True if a valid peak is found and processed; false otherwise.
+ */
+bool processPeak(MqsRawDataPoint_t a[], int size, MqsIndex_t *peakIndex, bool* isEdgeCase)
+{
+    MqsPeakResult_t result;
+
+    bool accepted = processPeakDetailed(a, size, NULL, NULL, &result);
+
+    *peakIndex = result.peakIndex;
+    *isEdgeCase = result.isEdgeCase;
+    return accepted;
 }
 
 bool mes_find_peak(MqsRawDataPoint_t* rawData, int size, int* sweepCounter) {
-    uint16_t peakIndex = 0;
+    MqsIndex_t peakIndex = 0;
     bool isPeakStillClimaxing = false;
    
     bool peakAccepted = processPeak(rawData, size, &peakIndex, &isPeakStillClimaxing);
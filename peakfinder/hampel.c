@@ -0,0 +1,347 @@
+/*!
+ * Hampel Spike Rejection
+ *
+ * Description:
+ * Replaces single-sample glitches, such as those caused by relay switching, by the median
+ * of the surrounding samples before detection, so they never become narrow candidates that
+ * use up the detector's attempts. The median of the sliding window is maintained with two
+ * indexed heaps; each step removes the sample leaving the window and inserts the one entering
+ * it in O(log w). The median absolute deviation is only recomputed when a cheap lower bound,
+ * carried over from the last exact computation, cannot already clear the sample.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+#include <stdbool.h>
+#include "mes_hampel.h"
+#include "mes_noise.h"
+#include "mes_workspace.h"
+#include "mes_noalloc.h"
+
+/*!
+ * @brief Restores the max-heap property below node i of a heap of count values.
+ */
+static void siftDownValues(float values[], int count, int i)
+{
+    for (;;)
+    {
+        int child = 2 * i + 1;
+        if (child >= count)
+        {
+            return;
+        }
+        if (child + 1 < count && values[child + 1] > values[child])
+        {
+            child++;
+        }
+        if (values[i] >= values[child])
+        {
+            return;
+        }
+        float tmp = values[i];
+        values[i] = values[child];
+        values[child] = tmp;
+        i = child;
+    }
+}
+
+/*!
+ * @brief Returns true if slot x belongs above slot y in the heap; lower is a max-heap, upper a min-heap.
+ */
+static inline bool heapBefore(const MqsHampel_t *filter, bool lower, int x, int y)
+{
+    return lower ? filter->values[x] > filter->values[y] : filter->values[x] < filter->values[y];
+}
+
+/*!
+ * @brief Stores slot at heap position i and records the position.
+ */
+static inline void heapPlace(MqsHampel_t *filter, bool lower, int i, int slot)
+{
+    if (lower)
+    {
+        filter->lower[i] = slot;
+        filter->position[slot] = i;
+    }
+    else
+    {
+        filter->upper[i] = slot;
+        filter->position[slot] = -1 - i;
+    }
+}
+
+/*!
+ * @brief Moves the slot at position i towards the root while it belongs above its parent.
+ */
+static void heapSiftUp(MqsHampel_t *filter, bool lower, int i)
+{
+    int *heap = lower ? filter->lower : filter->upper;
+    int slot = heap[i];
+
+    while (i > 0 && heapBefore(filter, lower, slot, heap[(i - 1) / 2]))
+    {
+        heapPlace(filter, lower, i, heap[(i - 1) / 2]);
+        i = (i - 1) / 2;
+    }
+    heapPlace(filter, lower, i, slot);
+}
+
+/*!
+ * @brief Moves the slot at position i towards the leaves while a child belongs above it.
+ */
+static void heapSiftDown(MqsHampel_t *filter, bool lower, int i)
+{
+    int *heap = lower ? filter->lower : filter->upper;
+    int count = lower ? filter->lowerCount : filter->upperCount;
+    int slot = heap[i];
+
+    for (;;)
+    {
+        int child = 2 * i + 1;
+        if (child >= count)
+        {
+            break;
+        }
+        if (child + 1 < count && heapBefore(filter, lower, heap[child + 1], heap[child]))
+        {
+            child++;
+        }
+        if (!heapBefore(filter, lower, heap[child], slot))
+        {
+            break;
+        }
+        heapPlace(filter, lower, i, heap[child]);
+        i = child;
+    }
+    heapPlace(filter, lower, i, slot);
+}
+
+/*!
+ * @brief Appends a slot to one heap.
+ */
+static void heapPush(MqsHampel_t *filter, bool lower, int slot)
+{
+    int i = lower ? filter->lowerCount++ : filter->upperCount++;
+    heapPlace(filter, lower, i, slot);
+    heapSiftUp(filter, lower, i);
+}
+
+/*!
+ * @brief Removes the slot at position i of one heap and returns it.
+ */
+static int heapRemoveAt(MqsHampel_t *filter, bool lower, int i)
+{
+    int *heap = lower ? filter->lower : filter->upper;
+    int last = lower ? --filter->lowerCount : --filter->upperCount;
+    int slot = heap[i];
+
+    if (i != last)
+    {
+        // The last slot fills the hole and may belong either above or below it
+        heapPlace(filter, lower, i, heap[last]);
+        heapSiftUp(filter, lower, i);
+        heapSiftDown(filter, lower, i);
+    }
+    return slot;
+}
+
+/*!
+ * @brief Keeps the lower half equal to the upper half or one slot larger.
+ */
+static void rebalance(MqsHampel_t *filter)
+{
+    if (filter->lowerCount > filter->upperCount + 1)
+    {
+        heapPush(filter, false, heapRemoveAt(filter, true, 0));
+    }
+    else if (filter->upperCount > filter->lowerCount)
+    {
+        heapPush(filter, true, heapRemoveAt(filter, false, 0));
+    }
+}
+
+/*!
+ * @brief Adds the sample in a ring slot to the window.
+ */
+static void windowInsert(MqsHampel_t *filter, int slot)
+{
+    bool lower = filter->lowerCount == 0 || filter->values[slot] <= filter->values[filter->lower[0]];
+    heapPush(filter, lower, slot);
+    rebalance(filter);
+    filter->madInserted++;
+}
+
+/*!
+ * @brief Removes the sample in a ring slot from the window.
+ */
+static void windowRemove(MqsHampel_t *filter, int slot)
+{
+    int position = filter->position[slot];
+    if (position >= 0)
+    {
+        heapRemoveAt(filter, true, position);
+    }
+    else
+    {
+        heapRemoveAt(filter, false, -1 - position);
+    }
+    rebalance(filter);
+}
+
+/*!
+ * @brief Returns the median of the window.
+ */
+static float windowMedian(const MqsHampel_t *filter)
+{
+    float low = filter->values[filter->lower[0]];
+    return (filter->lowerCount > filter->upperCount) ? low : 0.5f * (low + filter->values[filter->upper[0]]);
+}
+
+/*!
+ * @brief Sorts count values in ascending order by heapsort.
+ */
+static void sortAscending(float values[], int count)
+{
+    for (int i = count / 2 - 1; i >= 0; i--)
+    {
+        siftDownValues(values, count, i);
+    }
+    for (int end = count - 1; end > 0; end--)
+    {
+        float tmp = values[0];
+        values[0] = values[end];
+        values[end] = tmp;
+        siftDownValues(values, end, 0);
+    }
+}
+
+/*!
+ * @brief Returns the median absolute deviation of the window from its median.
+ *
+ * The smallest deviations, up to the MAD, are left sorted in scratch together with the median
+ * they were taken from, for windowMADLowerBound.
+ */
+static float windowMAD(MqsHampel_t *filter, float median)
+{
+    int count = filter->lowerCount + filter->upperCount;
+
+    for (int k = 0; k < filter->lowerCount; k++)
+    {
+        filter->scratch[k] = fabsf(filter->values[filter->lower[k]] - median);
+    }
+    for (int k = 0; k < filter->upperCount; k++)
+    {
+        filter->scratch[filter->lowerCount + k] = fabsf(filter->values[filter->upper[k]] - median);
+    }
+    // introselect leaves the count / 2 + 1 smallest deviations in front, only those are sorted
+    float mad = introselect(filter->scratch, count, count / 2);
+    sortAscending(filter->scratch, count / 2 + 1);
+
+    filter->madCount = count / 2 + 1;
+    filter->madMedian = median;
+    filter->madInserted = 0;
+    return mad;
+}
+
+/*!
+ * @brief Returns a lower bound of the median absolute deviation of the window, without a pass.
+ *
+ * Let D be the sorted deviations of the last exact computation, taken from median m0, and
+ * let n samples have entered the window since. Every sample still in the window has moved
+ * away from or towards the median by at most |m - m0|, and at most n of the k + 1 smallest
+ * current deviations belong to new samples, so the k-th smallest current deviation is at
+ * least D[k - n] - |m - m0|. Samples that have left the window do not weaken the bound.
+ *
+ * @return The bound, 0 if none is available.
+ */
+static float windowMADLowerBound(const MqsHampel_t *filter, float median)
+{
+    int rank = (filter->lowerCount + filter->upperCount) / 2 - filter->madInserted;
+    if (rank < 0 || rank >= filter->madCount)
+    {
+        return 0.0f;
+    }
+
+    float bound = filter->scratch[rank] - fabsf(median - filter->madMedian);
+    return (bound > 0.0f) ? bound : 0.0f;
+}
+
+size_t hampelWorkspaceSize(int halfWindow)
+{
+    int window = 2 * halfWindow + 1;
+    return 2 * WORKSPACE_BYTES(window, float) + 3 * WORKSPACE_BYTES(window, int) + WORKSPACE_ALIGNMENT;
+}
+
+bool hampelInit(MqsHampel_t *filter, const MqsHampelConfig_t *config, MqsWorkspace_t *workspace)
+{
+    *filter = (MqsHampel_t){ 0 };
+    if (config->halfWindow <= 0)
+    {
+        return false;
+    }
+
+    int window = 2 * config->halfWindow + 1;
+    filter->config = *config;
+    filter->window = window;
+    filter->values = workspaceAlloc(workspace, (size_t)window * sizeof(float));
+    filter->scratch = workspaceAlloc(workspace, (size_t)window * sizeof(float));
+    filter->lower = workspaceAlloc(workspace, (size_t)window * sizeof(int));
+    filter->upper = workspaceAlloc(workspace, (size_t)window * sizeof(int));
+    filter->position = workspaceAlloc(workspace, (size_t)window * sizeof(int));
+
+    return filter->values != NULL && filter->scratch != NULL && filter->lower != NULL &&
+           filter->upper != NULL && filter->position != NULL;
+}
+
+int hampelFilter(MqsHampel_t *filter, MqsRawDataPoint_t a[], int size, MqsIndex_t replaced[], int capacity)
+{
+    int half = filter->config.halfWindow;
+    int window = filter->window;
+    float threshold = filter->config.nSigma * HAMPEL_MAD_SCALE;
+    int replacedCount = 0;
+
+    filter->lowerCount = 0;
+    filter->upperCount = 0;
+    filter->madCount = 0;
+
+    // Prime the window with the samples to the right of the first centre
+    for (int j = 0; j < half && j < size; j++)
+    {
+        filter->values[j % window] = a[j].phaseAngle;
+        windowInsert(filter, j % window);
+    }
+
+    for (int i = 0; i < size; i++)
+    {
+        // The leaving and the entering sample share a ring slot, remove first
+        if (i - half - 1 >= 0)
+        {
+            windowRemove(filter, (i - half - 1) % window);
+        }
+        if (i + half < size)
+        {
+            filter->values[(i + half) % window] = a[i + half].phaseAngle;
+            windowInsert(filter, (i + half) % window);
+        }
+
+        // a[i] may only be overwritten now that its raw value is in the ring
+        float median = windowMedian(filter);
+        float deviation = fabsf(filter->values[i % window] - median);
+
+        // Most samples are cleared by the bound; the exact MAD is only needed near the threshold
+        if (deviation > filter->config.minDeviation && deviation > threshold * windowMADLowerBound(filter, median) &&
+            deviation > threshold * windowMAD(filter, median))
+        {
+            a[i].phaseAngle = median;
+            if (replaced != NULL && replacedCount < capacity)
+            {
+                replaced[replacedCount] = (MqsIndex_t)i;
+            }
+            replacedCount++;
+        }
+    }
+
+    return replacedCount;
+}
@@ -0,0 +1,119 @@
+/*!
+ * I/Q Ingestion
+ *
+ * Description:
+ * Converts the complex (I/Q) samples of a front end into phase angle and impedance
+ * magnitude with branch-free approximations of atan2 and the square root, and passes the
+ * sweep to the detector through workspace memory.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <stdbool.h>
+#include "mes_iqingest.h"
+#include "mes_workspace.h"
+#include "mes_noalloc.h"
+
+#define IQ_PI 3.14159265358979f
+#define IQ_RADIANS_TO_DEGREES (180.0f / IQ_PI)
+
+/*!
+ * @brief Returns a if the condition holds, b otherwise, by masking the bit patterns.
+ *
+ * Both values are always computed, so the compiler has no reason to branch and can
+ * vectorise the loops that use it without relaxing floating-point semantics.
+ */
+static inline float selectFloat(bool condition, float a, float b)
+{
+    uint32_t mask = 0u - (uint32_t)condition;
+    uint32_t bitsA;
+    uint32_t bitsB;
+
+    memcpy(&bitsA, &a, sizeof(bitsA));
+    memcpy(&bitsB, &b, sizeof(bitsB));
+    bitsA = (bitsA & mask) | (bitsB & ~mask);
+    memcpy(&a, &bitsA, sizeof(a));
+    return a;
+}
+
+/*!
+ * @brief Approximates atan2(y, x) in radians.
+ *
+ * The ratio of the smaller to the larger absolute component lies in [0, 1], where atan is
+ * approximated by an odd polynomial with a largest error of about 1e-5 rad; the octant is
+ * then restored with selects instead of branches.
+ */
+static inline float approxAtan2(float y, float x)
+{
+    float ax = fabsf(x);
+    float ay = fabsf(y);
+    bool steep = ay > ax;
+    float mx = selectFloat(steep, ay, ax);
+    float mn = selectFloat(steep, ax, ay);
+    float t = mn / selectFloat(mx > 0.0f, mx, 1.0f);
+    float s = t * t;
+
+    float r = ((((-0.0117212f * s + 0.05265332f) * s - 0.11643287f) * s + 0.19354346f) * s - 0.33262347f) * s * t + 0.99997726f * t;
+
+    r = selectFloat(steep, 0.5f * IQ_PI - r, r);
+    r = selectFloat(x < 0.0f, IQ_PI - r, r);
+    return copysignf(r, y);
+}
+
+/*!
+ * @brief Approximates sqrt(v) as v / sqrt(v) from a reciprocal square root estimate.
+ *
+ * The estimate starts from the exponent halving trick and is refined by two Newton steps,
+ * which leaves a relative error of about 5e-6.
+ */
+static inline float approxSqrt(float v)
+{
+    uint32_t bits;
+    float estimate;
+
+    memcpy(&bits, &v, sizeof(bits));
+    bits = 0x5F3759DFu - (bits >> 1);
+    memcpy(&estimate, &bits, sizeof(estimate));
+
+    estimate = estimate * (1.5f - 0.5f * v * estimate * estimate);
+    estimate = estimate * (1.5f - 0.5f * v * estimate * estimate);
+    return selectFloat(v > 0.0f, v * estimate, 0.0f);
+}
+
+void convertIQ(const float inPhase[], const float quadrature[], int size, MqsRawDataPoint_t points[])
+{
+    for (int i = 0; i < size; i++)
+    {
+        float re = inPhase[i];
+        float im = quadrature[i];
+        points[i].phaseAngle = approxAtan2(im, re) * IQ_RADIANS_TO_DEGREES;
+        points[i].impedance = approxSqrt(re * re + im * im);
+    }
+}
+
+size_t processPeakIQWorkspaceSize(int size, const MqsPeakConfig_t *config)
+{
+    return WORKSPACE_BYTES(size, MqsRawDataPoint_t) + processPeakWorkspaceSize(size, config) + WORKSPACE_ALIGNMENT;
+}
+
+bool processPeakIQ(const float inPhase[], const float quadrature[], int size, const MqsPeakConfig_t *config,
+                   MqsWorkspace_t *workspace, MqsPeakResult_t *result)
+{
+    size_t mark = workspaceMark(workspace);
+    MqsRawDataPoint_t *points = workspaceAlloc(workspace, (size_t)size * sizeof(MqsRawDataPoint_t));
+
+    *result = (MqsPeakResult_t){ 0 };
+    if (points == NULL)
+    {
+        return false;
+    }
+
+    convertIQ(inPhase, quadrature, size, points);
+    bool accepted = processPeakDetailed(points, size, config, workspace, result);
+
+    workspaceRelease(workspace, mark);
+    return accepted;
+}
@@ -0,0 +1,309 @@
+/*!
+ * Lorentzian Resonance Fit
+ *
+ * Description:
+ * Models the resonance of a sweep with a Lorentzian plus a constant offset, fitted by
+ * Levenberg-Marquardt on a window around the detected peak. The four-parameter normal
+ * equations are accumulated in one pass over the window with the analytic Jacobian and
+ * solved in place, so a fit costs a few microseconds and no allocation.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+#include <stdbool.h>
+#include "mes_lorentzian.h"
+#include "mes_noalloc.h"
+
+/*!
+ * @brief Parameters of the model: amplitude, centre, HWHM and offset, in samples.
+ */
+#define PARAMS 4
+
+/*!
+ * @brief Accumulates J^T J, J^T r and the sum of squared residuals over the window.
+ *
+ * @return The sum of squared residuals.
+ */
+static double accumulateNormalEquations(const MqsRawDataPoint_t a[], MqsInterval_t window, const double p[PARAMS],
+                                        double jtj[PARAMS][PARAMS], double jtr[PARAMS])
+{
+    double amplitude = p[0];
+    double centre = p[1];
+    double hwhm = p[2];
+    double offset = p[3];
+    double ssr = 0.0;
+
+    for (int r = 0; r < PARAMS; r++)
+    {
+        jtr[r] = 0.0;
+        for (int c = 0; c < PARAMS; c++)
+        {
+            jtj[r][c] = 0.0;
+        }
+    }
+
+    for (int i = window.left; i <= window.right; i++)
+    {
+        double u = (i - centre) / hwhm;
+        double l = 1.0 / (1.0 + u * u);
+        double residual = a[i].phaseAngle - (offset + amplitude * l);
+
+        // Partial derivatives of the model with respect to amplitude, centre, HWHM and offset
+        double j[PARAMS];
+        j[0] = l;
+        j[1] = amplitude * 2.0 * u * l * l / hwhm;
+        j[2] = amplitude * 2.0 * u * u * l * l / hwhm;
+        j[3] = 1.0;
+
+        for (int r = 0; r < PARAMS; r++)
+        {
+            jtr[r] += j[r] * residual;
+            for (int c = 0; c <= r; c++)
+            {
+                jtj[r][c] += j[r] * j[c];
+            }
+        }
+        ssr += residual * residual;
+    }
+
+    for (int r = 0; r < PARAMS; r++)
+    {
+        for (int c = r + 1; c < PARAMS; c++)
+        {
+            jtj[r][c] = jtj[c][r];
+        }
+    }
+    return ssr;
+}
+
+/*!
+ * @brief Inverts a symmetric (PARAMS x PARAMS) matrix by Gauss-Jordan elimination with partial pivoting.
+ *
+ * @return False if the matrix is singular.
+ */
+static bool invertMatrix(const double m[PARAMS][PARAMS], double inverse[PARAMS][PARAMS])
+{
+    double work[PARAMS][2 * PARAMS];
+
+    for (int r = 0; r < PARAMS; r++)
+    {
+        for (int c = 0; c < PARAMS; c++)
+        {
+            work[r][c] = m[r][c];
+            work[r][PARAMS + c] = (r == c) ? 1.0 : 0.0;
+        }
+    }
+
+    for (int col = 0; col < PARAMS; col++)
+    {
+        int pivot = col;
+        for (int r = col + 1; r < PARAMS; r++)
+        {
+            if (fabs(work[r][col]) > fabs(work[pivot][col]))
+            {
+                pivot = r;
+            }
+        }
+        if (fabs(work[pivot][col]) < 1e-300)
+        {
+            return false;
+        }
+        for (int c = 0; c < 2 * PARAMS; c++)
+        {
+            double tmp = work[col][c];
+            work[col][c] = work[pivot][c];
+            work[pivot][c] = tmp;
+        }
+
+        double scale = 1.0 / work[col][col];
+        for (int c = 0; c < 2 * PARAMS; c++)
+        {
+            work[col][c] *= scale;
+        }
+        for (int r = 0; r < PARAMS; r++)
+        {
+            if (r != col)
+            {
+                double factor = work[r][col];
+                for (int c = 0; c < 2 * PARAMS; c++)
+                {
+                    work[r][c] -= factor * work[col][c];
+                }
+            }
+        }
+    }
+
+    for (int r = 0; r < PARAMS; r++)
+    {
+        for (int c = 0; c < PARAMS; c++)
+        {
+            inverse[r][c] = work[r][PARAMS + c];
+        }
+    }
+    return true;
+}
+
+bool fitLorentzian(const MqsRawDataPoint_t a[], int size, const MqsPeakResult_t *peak,
+                   float startFrequency, float frequencyStep, MqsLorentzianFit_t *fit)
+{
+    *fit = (MqsLorentzianFit_t){ 0 };
+    if (frequencyStep == 0.0f)
+    {
+        printf("Lorentzian fit needs a non-zero frequency step.\n");
+        return false;
+    }
+
+    // Position and width from the detection, which are in samples whatever the detector read
+    double hwhm = (peak->fwhmInterpolated > 0.0f) ? 0.5 * peak->fwhmInterpolated : 0.5 * peak->fwhm;
+    double centre = peak->apexPosition;
+    hwhm = (hwhm < 1.0) ? 1.0 : hwhm;
+
+    int left = (int)floor(centre - LORENTZIAN_WINDOW_HWHM * hwhm);
+    int right = (int)ceil(centre + LORENTZIAN_WINDOW_HWHM * hwhm);
+    MqsInterval_t window = { (left < 0) ? 0 : left, (right > size - 1) ? size - 1 : right };
+    int n = window.right - window.left + 1;
+    fit->window = window;
+    if (n < LORENTZIAN_MIN_POINTS || peak->peakIndex >= (MqsIndex_t)size)
+    {
+        return false;
+    }
+
+    // Levels from the fitted samples themselves: the apex value and prominence of the result
+    // are measured after the baseline and the smoothing of the detection, if any
+    double offset = 0.5 * ((double)a[window.left].phaseAngle + a[window.right].phaseAngle);
+    double p[PARAMS] = { a[peak->peakIndex].phaseAngle - offset, centre, hwhm, offset };
+
+    double jtj[PARAMS][PARAMS];
+    double jtr[PARAMS];
+    double lambda = 1e-3;
+    double ssr = accumulateNormalEquations(a, window, p, jtj, jtr);
+    bool converged = false;
+    int iteration = 0;
+
+    while (iteration < LORENTZIAN_MAX_ITERATIONS && !converged)
+    {
+        iteration++;
+
+        // Marquardt damping of the diagonal, so the step adapts to the scale of each parameter
+        double damped[PARAMS][PARAMS];
+        double inverse[PARAMS][PARAMS];
+        for (int r = 0; r < PARAMS; r++)
+        {
+            for (int c = 0; c < PARAMS; c++)
+            {
+                damped[r][c] = jtj[r][c];
+            }
+            damped[r][r] += lambda * jtj[r][r];
+        }
+        if (!invertMatrix(damped, inverse))
+        {
+            break;
+        }
+
+        double trial[PARAMS];
+        double stepNorm = 0.0;
+        double paramNorm = 0.0;
+        for (int r = 0; r < PARAMS; r++)
+        {
+            double delta = 0.0;
+            for (int c = 0; c < PARAMS; c++)
+            {
+                delta += inverse[r][c] * jtr[c];
+            }
+            trial[r] = p[r] + delta;
+            stepNorm += delta * delta;
+            paramNorm += p[r] * p[r];
+        }
+        if (trial[2] <= 0.0)
+        {
+            // A non-positive width is outside the model; damp harder
+            lambda *= 10.0;
+            continue;
+        }
+
+        double trialJtj[PARAMS][PARAMS];
+        double trialJtr[PARAMS];
+        double trialSsr = accumulateNormalEquations(a, window, trial, trialJtj, trialJtr);
+
+        if (trialSsr <= ssr)
+        {
+            converged = sqrt(stepNorm) <= LORENTZIAN_TOLERANCE * (sqrt(paramNorm) + LORENTZIAN_TOLERANCE) ||
+                        ssr - trialSsr <= LORENTZIAN_TOLERANCE * ssr;
+            for (int r = 0; r < PARAMS; r++)
+            {
+                p[r] = trial[r];
+                jtr[r] = trialJtr[r];
+                for (int c = 0; c < PARAMS; c++)
+                {
+                    jtj[r][c] = trialJtj[r][c];
+                }
+            }
+            ssr = trialSsr;
+            lambda = (lambda > 1e-12) ? lambda * 0.1 : lambda;
+        }
+        else
+        {
+            lambda *= 10.0;
+            if (lambda > 1e12)
+            {
+                // No downhill step left at any damping: the current parameters are the minimum
+                converged = true;
+            }
+        }
+    }
+
+    // Covariance of the parameters, scaled by the residual variance
+    double covariance[PARAMS][PARAMS];
+    double variance = (n > PARAMS) ? ssr / (n - PARAMS) : 0.0;
+    bool hasCovariance = invertMatrix(jtj, covariance);
+    double scale = (frequencyStep != 0.0f) ? frequencyStep : 1.0;
+
+    fit->amplitude = (float)p[0];
+    fit->centre = (float)(startFrequency + scale * p[1]);
+    fit->hwhm = (float)(fabs(scale) * p[2]);
+    fit->offset = (float)p[3];
+    fit->q = (fit->hwhm > 0.0f) ? fit->centre / (2.0f * fit->hwhm) : 0.0f;
+    fit->dampingRatio = (fit->q != 0.0f) ? 1.0f / (2.0f * fit->q) : 0.0f;
+    fit->residualRms = (float)sqrt(ssr / n);
+    fit->iterations = iteration;
+    fit->converged = converged && hasCovariance;
+
+    if (hasCovariance)
+    {
+        double centreVariance = variance * covariance[1][1] * scale * scale;
+        double hwhmVariance = variance * covariance[2][2] * scale * scale;
+        double crossVariance = variance * covariance[1][2] * scale * fabs(scale);
+        double f0 = fit->centre;
+        double g = fit->hwhm;
+
+        fit->amplitudeError = (float)sqrt(variance * covariance[0][0]);
+        fit->centreError = (float)sqrt(centreVariance);
+        fit->hwhmError = (float)sqrt(hwhmVariance);
+        fit->offsetError = (float)sqrt(variance * covariance[3][3]);
+
+        // First-order propagation through Q = f0 / (2 g), including the correlation of f0 and g
+        if (f0 != 0.0 && g > 0.0)
+        {
+            double relative = centreVariance / (f0 * f0) + hwhmVariance / (g * g) - 2.0 * crossVariance / (f0 * g);
+            relative = (relative > 0.0) ? relative : 0.0;
+            fit->qError = (float)(fabs(fit->q) * sqrt(relative));
+            fit->dampingRatioError = (float)(fabs(fit->dampingRatio) * sqrt(relative));
+        }
+    }
+
+    return fit->converged;
+}
+
+int fitLorentzianBatch(MqsRawDataPoint_t *sweeps[], const int sizes[], const MqsPeakResult_t peaks[], int count,
+                       float startFrequency, float frequencyStep, MqsLorentzianFit_t fits[])
+{
+    int converged = 0;
+
+    for (int s = 0; s < count; s++)
+    {
+        converged += fitLorentzian(sweeps[s], sizes[s], &peaks[s], startFrequency, frequencyStep, &fits[s]);
+    }
+    return converged;
+}
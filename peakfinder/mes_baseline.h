@@ -0,0 +1,84 @@
+#ifndef BASELINE_H
+#define BASELINE_H
+
+/*******************************************************************************
+ * Includes
+ ******************************************************************************/
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "mes_peakfinder.h"
+
+ /*******************************************************************************
+  * Defines
+  ******************************************************************************/
+
+/*!
+ * @brief Weight of the samples above the baseline in the reweighted fit.
+ *
+ * Samples below the baseline have weight 1. The small weight above keeps peaks from lifting
+ * the baseline, which settles along the lower envelope of the sweep.
+ */
+#define BASELINE_ASYMMETRY 0.05f
+
+/*!
+ * @brief Reweighting iterations of a fit from scratch and of the refinement of a cached fit.
+ */
+#define BASELINE_ITERATIONS        8
+#define BASELINE_REFINE_ITERATIONS 2
+
+   /*******************************************************************************
+	* Functions
+	******************************************************************************/
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+	/**
+	 * @brief Initialises an empty baseline cache.
+	 *
+	 * @param baseline Pointer to the cache.
+	 * @param degree The degree of the polynomial, clamped to 0 .. MES_BASELINE_MAX_DEGREE.
+	 * @param refreshInterval Sweeps a fit is reused for; 1 refines it on every sweep.
+	 */
+	void baselineInit(MqsBaseline_t *baseline, int degree, int refreshInterval);
+
+	/**
+	 * @brief Fits the baseline of a sweep by iteratively reweighted least squares.
+	 *
+	 * Each iteration is one O(n) pass accumulating the weighted normal equations, so the
+	 * whole fit is O(n) and needs no memory besides the cache. A valid cached fit of a sweep
+	 * of the same length is refined in BASELINE_REFINE_ITERATIONS instead of refitted.
+	 *
+	 * @param baseline Pointer to the cache.
+	 * @param a The raw data array.
+	 * @param size The size of the array.
+	 * @return False if the sweep has fewer samples than coefficients.
+	 */
+	bool baselineFit(MqsBaseline_t *baseline, const MqsRawDataPoint_t a[], int size);
+
+	/**
+	 * @brief Refits the baseline if the cache is empty, stale or of another sweep length.
+	 *
+	 * @param baseline Pointer to the cache.
+	 * @param a The raw data array.
+	 * @param size The size of the array.
+	 * @return False if the cache holds no usable fit for the sweep.
+	 */
+	bool baselineUpdate(MqsBaseline_t *baseline, const MqsRawDataPoint_t a[], int size);
+
+	/**
+	 * @brief Evaluates the baseline at sample i.
+	 *
+	 * @param baseline Pointer to a fitted cache.
+	 * @param i The index of the sample.
+	 * @return The baseline phase angle.
+	 */
+	float baselineAt(const MqsBaseline_t *baseline, int i);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BASELINE_H */
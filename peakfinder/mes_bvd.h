@@ -0,0 +1,96 @@
+#ifndef BVD_H
+#define BVD_H
+
+/*******************************************************************************
+ * Includes
+ ******************************************************************************/
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "mes_peakfinder.h"
+#include "mes_resonance.h"
+
+  /*******************************************************************************
+   * Type definitions
+   ******************************************************************************/
+
+/*!
+ * @brief Resonance measurements of a batch of sweeps, one array entry per sweep.
+ *
+ * Frequencies in Hz, resistance in ohms. Kept as separate arrays so the extraction runs
+ * across sweeps in vector registers.
+ */
+typedef struct {
+	float *seriesFrequency;		/**< fs, frequency of the impedance minimum. */
+	float *parallelFrequency;	/**< fp, frequency of the impedance maximum. */
+	float *seriesResistance;	/**< Impedance at fs. */
+	float *bandwidth;			/**< Half-power bandwidth of the admittance around fs. */
+} MqsBvdMeasurements_t;
+
+/*!
+ * @brief Butterworth-Van Dyke parameters of a batch of sweeps, one array entry per sweep.
+ *
+ * The motional branch R1, L1, C1 in series, in parallel with the shunt capacitance C0.
+ * SI units: ohms, henries, farads.
+ */
+typedef struct {
+	float *resistance;			/**< R1. */
+	float *inductance;			/**< L1. */
+	float *capacitance;			/**< C1. */
+	float *shuntCapacitance;	/**< C0. */
+	float *quality;				/**< Q of the motional branch, fs / bandwidth. */
+} MqsBvdParameters_t;
+
+   /*******************************************************************************
+	* Functions
+	******************************************************************************/
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+	/**
+	 * @brief Measures the resonance of one sweep into one entry of a batch.
+	 *
+	 * The frequencies are taken from the resonance pair and the resistance is the impedance
+	 * at its minimum. The bandwidth is the width between the interpolated points at which the
+	 * impedance has risen to sqrt(2) times the minimum, where the admittance is down 3 dB; if
+	 * only one side is inside the sweep, the width is taken as twice that side.
+	 *
+	 * The input is a resonance pair rather than an MqsPeakResult_t because the model needs the
+	 * anti-resonance, which a single detected peak does not carry, and because the half-power
+	 * level sqrt(2) |Z|min is not one of the levels the peak detector measures a width at: its
+	 * FWHM is taken at half the prominence of the phase angle.
+	 *
+	 * @param a The raw data array.
+	 * @param size The size of the array.
+	 * @param pair The resonance and anti-resonance, from pairResonances.
+	 * @param frequencyStep The frequency step between samples.
+	 * @param measurements The batch.
+	 * @param slot The entry of the batch to fill.
+	 * @return False if neither half-power point lies inside the sweep; the entry is then zeroed.
+	 */
+	bool measureBvd(const MqsRawDataPoint_t a[], int size, const MqsResonancePair_t *pair, float frequencyStep,
+					const MqsBvdMeasurements_t *measurements, int slot);
+
+	/**
+	 * @brief Computes the BVD parameters of a batch of sweeps in closed form.
+	 *
+	 * With w = 2 pi fs and Q = fs / bandwidth: R1 = |Z(fs)|, L1 = Q R1 / w, C1 = 1 / (w Q R1)
+	 * and C0 = C1 / ((fp / fs)^2 - 1). This assumes R1 is small against the reactance of C0
+	 * at fs, as in any usable piezo resonator. The loop has no branches and vectorises
+	 * across sweeps.
+	 *
+	 * @param measurements The measurements of count sweeps.
+	 * @param count The number of sweeps.
+	 * @param parameters Output, the parameters of count sweeps; all are 0 for the entries
+	 *                   whose measurements are not physical.
+	 * @return The number of sweeps with physical measurements.
+	 */
+	int extractBvdBatch(const MqsBvdMeasurements_t *measurements, int count, const MqsBvdParameters_t *parameters);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BVD_H */
@@ -0,0 +1,159 @@
+#ifndef CSVINGEST_H
+#define CSVINGEST_H
+
+/*******************************************************************************
+ * Includes
+ ******************************************************************************/
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "mes_peakfinder.h"
+
+ /*******************************************************************************
+  * Defines
+  ******************************************************************************/
+
+/*!
+ * @brief Maximum number of parser threads used by csvIngestBuffer.
+ */
+#define CSV_INGEST_MAX_THREADS 16
+
+/*!
+ * @brief Nominal size of the chunks the input is split into, moved forward to a sweep boundary.
+ */
+#ifndef CSV_INGEST_CHUNK_BYTES
+#define CSV_INGEST_CHUNK_BYTES (1u << 20)
+#endif
+
+/*!
+ * @brief Number of chunk buffers, bounding how far the parsers may run ahead of the callback.
+ *
+ * Each ingester uses two buffers per thread.
+ */
+#define CSV_INGEST_QUEUE_DEPTH (2 * CSV_INGEST_MAX_THREADS)
+
+  /*******************************************************************************
+   * Type definitions
+   ******************************************************************************/
+
+/*!
+ * @brief Layout of the exported text files.
+ *
+ * Every line holds one sweep point; sweeps are separated by one or more blank lines.
+ * Lines whose phase or impedance column is not a number (headers, comments) are skipped.
+ */
+typedef struct {
+	int phaseColumn;		/**< Zero-based column of the phase angle. */
+	int impedanceColumn;	/**< Zero-based column of the impedance. */
+	char delimiter;			/**< Column separator, e.g. ',' or ';'. */
+} MqsCsvFormat_t;
+
+/*!
+ * @brief Receives parsed sweeps in file order, up to MES_BATCH_LANES at a time.
+ *
+ * The sweep buffers belong to the ingester and are reused once the callback returns.
+ * Batches are full except at the end of the input, or when a batch would otherwise hold
+ * back more chunk buffers than the queue allows.
+ *
+ * @param sweeps Array of count pointers to the sweeps.
+ * @param sizes Array of count sweep sizes.
+ * @param count Number of sweeps in the batch.
+ * @param user The user pointer passed to csvIngestBuffer or csvIngestFile.
+ */
+typedef void (*MqsSweepBatchCallback_t)(MqsRawDataPoint_t *sweeps[], const int sizes[], int count, void *user);
+
+/*!
+ * @brief Reusable parse buffers of one chunk of the input.
+ */
+typedef struct {
+	const char *begin;
+	const char *end;
+	MqsRawDataPoint_t *points;	/**< Arena holding the points of all sweeps of the chunk. */
+	size_t pointCapacity;
+	size_t pointCount;
+	size_t *sweepStart;			/**< Offset of every sweep in points. */
+	int *sweepSize;
+	size_t sweepCapacity;
+	size_t sweepCount;
+	bool ok;
+	bool ready;					/**< Parsed and waiting for the callback. */
+	const MqsCsvFormat_t *format;
+} MqsCsvChunk_t;
+
+/*!
+ * @brief Ingestion state. The buffers grow to the largest input seen and are then reused.
+ */
+typedef struct {
+	MqsCsvFormat_t format;
+	int numThreads;
+	MqsCsvChunk_t chunks[CSV_INGEST_QUEUE_DEPTH];
+} MqsCsvIngest_t;
+
+   /*******************************************************************************
+	* Functions
+	******************************************************************************/
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+	/**
+	 * @brief Initialises an ingester.
+	 *
+	 * @param ingest Pointer to the ingester.
+	 * @param format Layout of the input files.
+	 * @param numThreads Number of parser threads, clamped to [1, CSV_INGEST_MAX_THREADS].
+	 */
+	void csvIngestInit(MqsCsvIngest_t *ingest, const MqsCsvFormat_t *format, int numThreads);
+
+	/**
+	 * @brief Parses a text buffer in parallel and streams the sweeps to a callback.
+	 *
+	 * The buffer is split into chunks of about CSV_INGEST_CHUNK_BYTES that the threads parse
+	 * into a bounded queue of buffers. The calling thread passes the sweeps of each chunk to
+	 * the callback as soon as that chunk and all earlier ones are parsed, and hands the buffer
+	 * back to the parsers once all its sweeps have been delivered. Between callbacks it also
+	 * parses chunks itself.
+	 *
+	 * @param ingest Pointer to the ingester.
+	 * @param data The text to parse.
+	 * @param length The length of the text in bytes.
+	 * @param callback Receives the sweeps in batches, in input order.
+	 * @param user Forwarded to the callback.
+	 * @return true if the whole buffer was parsed, false on allocation or thread failure.
+	 */
+	bool csvIngestBuffer(MqsCsvIngest_t *ingest, const char *data, size_t length, MqsSweepBatchCallback_t callback, void *user);
+
+	/**
+	 * @brief Maps a text file and passes it to csvIngestBuffer.
+	 *
+	 * @param ingest Pointer to the ingester.
+	 * @param path Path of the file.
+	 * @param callback Receives the sweeps in batches, in input order.
+	 * @param user Forwarded to the callback.
+	 * @return true if the whole file was parsed, false otherwise.
+	 */
+	bool csvIngestFile(MqsCsvIngest_t *ingest, const char *path, MqsSweepBatchCallback_t callback, void *user);
+
+	/**
+	 * @brief Releases the buffers of an ingester.
+	 */
+	void csvIngestFree(MqsCsvIngest_t *ingest);
+
+	/**
+	 * @brief Parses a decimal floating point number without locale lookups.
+	 *
+	 * Accepts an optional sign, digits with an optional '.' and an optional exponent.
+	 *
+	 * @param p Start of the text.
+	 * @param end End of the text.
+	 * @param value Pointer to store the parsed value.
+	 * @return Pointer to the first character after the number, or NULL if there is none.
+	 */
+	const char *csvParseFloat(const char *p, const char *end, float *value);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CSVINGEST_H */
@@ -0,0 +1,136 @@
+#ifndef DEMODULATOR_H
+#define DEMODULATOR_H
+
+/*******************************************************************************
+ * Includes
+ ******************************************************************************/
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "mes_peakfinder.h"
+#include "mes_workspace.h"
+
+ /*******************************************************************************
+  * Defines
+  ******************************************************************************/
+
+/*!
+ * @brief Smallest current energy, relative to the voltage energy, for which V / I is computed.
+ *
+ * Bins below it carry no usable current (a dropped probe, a tone missing from the record)
+ * and would yield an infinite or NaN impedance, or a huge one from the leakage of the other
+ * tones. The ratio is |Z|^-2, so impedances up to 1e6 in the units of the signals are
+ * measured; scale the response (e.g. by the sense resistor) so that real impedances stay
+ * below that.
+ */
+#ifndef DEMODULATOR_MIN_CURRENT_RATIO
+#define DEMODULATOR_MIN_CURRENT_RATIO 1e-12f
+#endif
+
+  /*******************************************************************************
+   * Type definitions
+   ******************************************************************************/
+
+/*!
+ * @brief Bank of Goertzel filters, one per sweep frequency, on the excitation and the response.
+ *
+ * Every table holds one entry per frequency, so the filters of all frequencies are updated
+ * together by one vectorisable loop per time sample. The tables live in a workspace.
+ */
+typedef struct {
+	int numFrequencies;
+	float *coefficient;	/**< 2 cos(w) per frequency. */
+	float *cosine;		/**< cos(w) per frequency. */
+	float *sine;		/**< sin(w) per frequency. */
+	float *excitation1;	/**< Last filter state of the excitation. */
+	float *excitation2;	/**< Filter state before the last one of the excitation. */
+	float *response1;	/**< Last filter state of the response. */
+	float *response2;	/**< Filter state before the last one of the response. */
+} MqsGoertzelBank_t;
+
+   /*******************************************************************************
+	* Functions
+	******************************************************************************/
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+	/**
+	 * @brief Returns the workspace size needed by goertzelBankInit.
+	 *
+	 * @param numFrequencies The number of sweep frequencies.
+	 * @return The number of workspace bytes.
+	 */
+	size_t goertzelBankWorkspaceSize(int numFrequencies);
+
+	/**
+	 * @brief Sets up a filter bank in the workspace and clears its state.
+	 *
+	 * The tables stay allocated until the caller releases the workspace.
+	 *
+	 * @param bank Pointer to the bank.
+	 * @param frequencies The sweep frequencies, in Hz.
+	 * @param numFrequencies The number of sweep frequencies.
+	 * @param sampleRate The sampling rate of the time-domain samples, in Hz.
+	 * @param workspace Scratch memory of at least goertzelBankWorkspaceSize bytes.
+	 * @return False if the workspace is too small.
+	 */
+	bool goertzelBankInit(MqsGoertzelBank_t *bank, const float frequencies[], int numFrequencies, float sampleRate, MqsWorkspace_t *workspace);
+
+	/**
+	 * @brief Clears the filter state to start a new record.
+	 */
+	void goertzelBankReset(MqsGoertzelBank_t *bank);
+
+	/**
+	 * @brief Feeds the next block of time-domain samples to every filter of the bank.
+	 *
+	 * Blocks can have any length, so samples can be streamed as they are acquired.
+	 *
+	 * @param bank Pointer to the bank.
+	 * @param excitation The excitation (voltage) samples.
+	 * @param response The response (current) samples, taken at the same instants.
+	 * @param count The number of samples of the block.
+	 */
+	void goertzelBankUpdate(MqsGoertzelBank_t *bank, const float excitation[], const float response[], int count);
+
+	/**
+	 * @brief Converts the filter outputs into one sweep point per frequency.
+	 *
+	 * The impedance is |V / I| in the units of the excitation over those of the response,
+	 * and the phase angle is arg(V / I) in degrees. A bin whose current energy is at or below
+	 * DEMODULATOR_MIN_CURRENT_RATIO times its voltage energy is written as phase angle 0 and
+	 * impedance 0 instead of infinity or NaN, which every comparison of the detector would
+	 * silently fail on.
+	 *
+	 * @param bank Pointer to the bank.
+	 * @param points Output, one point per frequency.
+	 * @return The number of bins with a usable current.
+	 */
+	int goertzelBankFinish(const MqsGoertzelBank_t *bank, MqsRawDataPoint_t points[]);
+
+	/**
+	 * @brief Demodulates a whole record into a sweep.
+	 *
+	 * The record must contain every sweep frequency, e.g. a chirp or a multi-tone excitation.
+	 * For a stepped sweep, demodulate each step with its own frequency.
+	 *
+	 * @param excitation The excitation (voltage) samples.
+	 * @param response The response (current) samples.
+	 * @param numSamples The length of the record.
+	 * @param sampleRate The sampling rate, in Hz.
+	 * @param frequencies The sweep frequencies, in Hz.
+	 * @param numFrequencies The number of sweep frequencies.
+	 * @param workspace Scratch memory of at least goertzelBankWorkspaceSize bytes, released on return.
+	 * @param points Output, one point per frequency; bins without current as by goertzelBankFinish.
+	 * @return False if the workspace is too small or no bin has a usable current.
+	 */
+	bool demodulateSweep(const float excitation[], const float response[], int numSamples, float sampleRate,
+						 const float frequencies[], int numFrequencies, MqsWorkspace_t *workspace, MqsRawDataPoint_t points[]);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* DEMODULATOR_H */
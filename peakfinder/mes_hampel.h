@@ -0,0 +1,110 @@
+#ifndef HAMPEL_H
+#define HAMPEL_H
+
+/*******************************************************************************
+ * Includes
+ ******************************************************************************/
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "mes_peakfinder.h"
+#include "mes_workspace.h"
+
+ /*******************************************************************************
+  * Defines
+  ******************************************************************************/
+
+/*!
+ * @brief Scale of the median absolute deviation to the standard deviation of Gaussian noise.
+ */
+#define HAMPEL_MAD_SCALE 1.4826f
+
+  /*******************************************************************************
+   * Type definitions
+   ******************************************************************************/
+
+/*!
+ * @brief Options of the Hampel filter.
+ *
+ * A sample is replaced by the median of its window when it deviates from that median by
+ * more than both minDeviation and nSigma scaled median absolute deviations of the window.
+ */
+typedef struct {
+	int halfWindow;		/**< Samples on each side of the centre, the window holds 2 * halfWindow + 1. */
+	float nSigma;		/**< Threshold in standard deviations, typically 3. */
+	float minDeviation;	/**< Deviations up to this value are kept without computing the MAD. */
+} MqsHampelConfig_t;
+
+/*!
+ * @brief State of the sliding-window Hampel filter.
+ *
+ * The window is kept in a ring buffer of raw samples and split into two indexed heaps, a
+ * max-heap of the lower half and a min-heap of the upper half, so that moving the window by
+ * one sample and reading its median costs O(log w). The MAD is only computed exactly for the
+ * samples that deviate from the median by more than minDeviation and that a lower bound of
+ * the MAD, derived from the sorted deviations of the last exact computation, cannot clear.
+ */
+typedef struct {
+	MqsHampelConfig_t config;
+	int window;			/**< Capacity of the ring buffer, 2 * halfWindow + 1. */
+	float *values;		/**< Ring buffer of the raw samples of the window. */
+	int *lower;			/**< Max-heap of the ring slots of the lower half. */
+	int *upper;			/**< Min-heap of the ring slots of the upper half. */
+	int *position;		/**< Heap position of each slot, >= 0 in lower, < 0 in upper (-1 - position). */
+	float *scratch;		/**< Absolute deviations of the window, sorted up to the MAD after each exact MAD. */
+	int lowerCount;
+	int upperCount;
+	int madCount;		/**< Entries of scratch, 0 if no exact MAD has been computed for the sweep. */
+	float madMedian;	/**< Median the deviations in scratch were taken from. */
+	int madInserted;	/**< Samples that entered the window since the last exact MAD. */
+} MqsHampel_t;
+
+   /*******************************************************************************
+	* Functions
+	******************************************************************************/
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+	/**
+	 * @brief Returns the workspace size needed by hampelInit.
+	 *
+	 * @param halfWindow The half window of the filter.
+	 * @return The number of workspace bytes.
+	 */
+	size_t hampelWorkspaceSize(int halfWindow);
+
+	/**
+	 * @brief Sets up a filter in the workspace.
+	 *
+	 * The tables stay allocated until the caller releases the workspace; the same filter can
+	 * be applied to any number of sweeps.
+	 *
+	 * @param filter Pointer to the filter.
+	 * @param config The filter options.
+	 * @param workspace Scratch memory of at least hampelWorkspaceSize bytes.
+	 * @return False if the workspace is too small or the half window is not positive.
+	 */
+	bool hampelInit(MqsHampel_t *filter, const MqsHampelConfig_t *config, MqsWorkspace_t *workspace);
+
+	/**
+	 * @brief Replaces the outliers of the phase angle of a sweep in place.
+	 *
+	 * The window is centred on each sample and truncated at the ends of the sweep. The
+	 * medians and deviations are always taken over the raw samples, never over replaced ones.
+	 *
+	 * @param filter Pointer to the filter.
+	 * @param a The raw data array, modified in place.
+	 * @param size The size of the array.
+	 * @param replaced Output, indices of the replaced samples in increasing order, may be NULL.
+	 * @param capacity The number of entries of replaced.
+	 * @return The number of replaced samples; only the first capacity indices are stored.
+	 */
+	int hampelFilter(MqsHampel_t *filter, MqsRawDataPoint_t a[], int size, MqsIndex_t replaced[], int capacity);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* HAMPEL_H */
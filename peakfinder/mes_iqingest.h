@@ -0,0 +1,74 @@
+#ifndef IQINGEST_H
+#define IQINGEST_H
+
+/*******************************************************************************
+ * Includes
+ ******************************************************************************/
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "mes_peakfinder.h"
+#include "mes_workspace.h"
+
+ /*******************************************************************************
+  * Defines
+  ******************************************************************************/
+
+/*!
+ * @brief Largest error of the phase computed by convertIQ, in degrees.
+ */
+#define IQ_PHASE_MAX_ERROR_DEGREES 0.001f
+
+   /*******************************************************************************
+	* Functions
+	******************************************************************************/
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+	/**
+	 * @brief Converts I/Q samples into sweep points.
+	 *
+	 * The phase angle is computed in degrees with a polynomial atan2 whose error stays below
+	 * IQ_PHASE_MAX_ERROR_DEGREES, and the impedance is the magnitude sqrt(I^2 + Q^2) computed
+	 * through a reciprocal square root. The loop has no branches, so the compiler vectorises it.
+	 *
+	 * @param inPhase The real parts.
+	 * @param quadrature The imaginary parts.
+	 * @param size The number of samples.
+	 * @param points Output, size sweep points.
+	 */
+	void convertIQ(const float inPhase[], const float quadrature[], int size, MqsRawDataPoint_t points[]);
+
+	/**
+	 * @brief Returns the workspace size needed by processPeakIQ.
+	 *
+	 * @param size The size of the sweeps that will be processed.
+	 * @param config The configuration that will be used, or NULL for the defaults.
+	 * @return The number of workspace bytes.
+	 */
+	size_t processPeakIQWorkspaceSize(int size, const MqsPeakConfig_t *config);
+
+	/**
+	 * @brief Converts an I/Q sweep and runs processPeakDetailed on it.
+	 *
+	 * The sweep points are written to the workspace and released on return, so the same
+	 * workspace serves every sweep and no point array is allocated.
+	 *
+	 * @param inPhase The real parts.
+	 * @param quadrature The imaginary parts.
+	 * @param size The number of samples.
+	 * @param config Options of processPeakDetailed, or NULL for the defaults.
+	 * @param workspace Scratch memory of at least processPeakIQWorkspaceSize bytes.
+	 * @param result Pointer to the structure receiving the description of the peak.
+	 * @return True if a valid peak is found; false otherwise or if the workspace is too small.
+	 */
+	bool processPeakIQ(const float inPhase[], const float quadrature[], int size, const MqsPeakConfig_t *config,
+					   MqsWorkspace_t *workspace, MqsPeakResult_t *result);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* IQINGEST_H */
@@ -0,0 +1,120 @@
+#ifndef LORENTZIAN_H
+#define LORENTZIAN_H
+
+/*******************************************************************************
+ * Includes
+ ******************************************************************************/
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "mes_peakfinder.h"
+
+ /*******************************************************************************
+  * Defines
+  ******************************************************************************/
+
+/*!
+ * @brief Half extent of the fitted window around the seed centre, in seed HWHMs.
+ */
+#define LORENTZIAN_WINDOW_HWHM 4.0f
+
+/*!
+ * @brief Fewest samples a window may hold; the model has four parameters.
+ */
+#define LORENTZIAN_MIN_POINTS 8
+
+/*!
+ * @brief Iteration limit and relative step size at which the solver stops.
+ */
+#define LORENTZIAN_MAX_ITERATIONS 50
+#define LORENTZIAN_TOLERANCE      1e-6
+
+  /*******************************************************************************
+   * Type definitions
+   ******************************************************************************/
+
+/*!
+ * @brief Lorentzian fitted to a resonance, with one-sigma uncertainties.
+ *
+ * The model is offset + amplitude / (1 + ((f - centre) / hwhm)^2). Frequencies are in the
+ * units of the start frequency and step given to the fit; Q = centre / (2 * hwhm) and the
+ * damping ratio is 1 / (2 * Q). The uncertainties come from the covariance of the fit,
+ * scaled by the residual variance.
+ */
+typedef struct {
+	float centre;				/**< Resonance frequency. */
+	float hwhm;					/**< Half width at half maximum. */
+	float amplitude;			/**< Height above the offset. */
+	float offset;				/**< Level far from the resonance. */
+	float q;					/**< Quality factor. */
+	float dampingRatio;			/**< Damping ratio. */
+	float centreError;
+	float hwhmError;
+	float amplitudeError;
+	float offsetError;
+	float qError;
+	float dampingRatioError;
+	float residualRms;			/**< Root mean square of the residuals in the window. */
+	MqsInterval_t window;		/**< Samples the fit was computed on. */
+	int iterations;				/**< Levenberg-Marquardt iterations performed. */
+	bool converged;				/**< False if the iteration limit was reached or the fit degenerated. */
+} MqsLorentzianFit_t;
+
+   /*******************************************************************************
+	* Functions
+	******************************************************************************/
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+	/**
+	 * @brief Fits a Lorentzian to the peak found by processPeakDetailed.
+	 *
+	 * Levenberg-Marquardt with the analytic Jacobian of the model, restricted to
+	 * LORENTZIAN_WINDOW_HWHM seed half widths on each side of the apex. The centre and width
+	 * are seeded from the refined apex and the interpolated FWHM of the detection result, the
+	 * amplitude and offset from the samples at the peak and at the window ends.
+	 *
+	 * The fit models the phase angles as stored in the array, which includes the in-place
+	 * unwrapping and despiking of processPeakDetailed but not its baseline subtraction or
+	 * smoothing. Smoothing only costs precision, but the constant offset cannot follow a
+	 * drift, so detect with a configuration without baseline when the sweep is to be fitted.
+	 * The fit needs no memory besides the stack and is reentrant.
+	 *
+	 * @param a The data array passed to processPeakDetailed.
+	 * @param size The size of the array.
+	 * @param peak The detection result of the sweep.
+	 * @param startFrequency The frequency of sample 0.
+	 * @param frequencyStep The frequency step between samples, must not be 0. With a start of
+	 *                      0 and a step of 1 the results are in samples, and Q and the damping
+	 *                      ratio then depend on the arbitrary origin.
+	 * @param fit Output, the fitted resonance.
+	 * @return True if the fit converged; false without fitting if the frequency step is 0.
+	 */
+	bool fitLorentzian(const MqsRawDataPoint_t a[], int size, const MqsPeakResult_t *peak,
+					   float startFrequency, float frequencyStep, MqsLorentzianFit_t *fit);
+
+	/**
+	 * @brief Fits the resonances of several sweeps.
+	 *
+	 * Takes the sweeps in the layout of MqsSweepBatchCallback_t, so the fits can run inside
+	 * the ingestion callback, on the thread that detected the peaks.
+	 *
+	 * @param sweeps Array of count pointers to the sweeps.
+	 * @param sizes Array of count sweep sizes.
+	 * @param peaks Array of count detection results.
+	 * @param count Number of sweeps.
+	 * @param startFrequency The frequency of sample 0 of every sweep.
+	 * @param frequencyStep The frequency step between samples.
+	 * @param fits Output, array of count fits.
+	 * @return The number of fits that converged.
+	 */
+	int fitLorentzianBatch(MqsRawDataPoint_t *sweeps[], const int sizes[], const MqsPeakResult_t peaks[], int count,
+						   float startFrequency, float frequencyStep, MqsLorentzianFit_t fits[]);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LORENTZIAN_H */
@@ -0,0 +1,47 @@
+#ifndef NOALLOC_H
+#define NOALLOC_H
+
+/*******************************************************************************
+ * Includes
+ ******************************************************************************/
+#include <stdlib.h>
+
+/*******************************************************************************
+ * Internal header
+ *
+ * Included last by the source files of the detection engine only, never by a public
+ * header, so client code and the ingestion and archive front ends, which allocate
+ * legitimately, are not affected by MES_DEBUG_NO_ALLOC.
+ ******************************************************************************/
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+	/**
+	 * @brief Aborts with a diagnostic. Target of the allocation guard below.
+	 */
+	void *workspaceForbiddenAlloc(const char *file, int line);
+
+#ifdef __cplusplus
+}
+#endif
+
+/*!
+ * @brief Allocation guard for the detection engine.
+ *
+ * With MES_DEBUG_NO_ALLOC defined, every malloc, calloc or realloc written in an engine
+ * source file aborts, so a debug build proves the engine never reaches the heap in steady
+ * state. Allocations made inside the C library, such as the buffers of printf, are not
+ * seen by the macros.
+ */
+#ifdef MES_DEBUG_NO_ALLOC
+#undef malloc
+#undef calloc
+#undef realloc
+#define malloc(size)		workspaceForbiddenAlloc(__FILE__, __LINE__)
+#define calloc(count, size)	workspaceForbiddenAlloc(__FILE__, __LINE__)
+#define realloc(ptr, size)	workspaceForbiddenAlloc(__FILE__, __LINE__)
+#endif
+
+#endif /* NOALLOC_H */
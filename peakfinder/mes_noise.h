@@ -0,0 +1,95 @@
+#ifndef NOISE_H
+#define NOISE_H
+
+/*******************************************************************************
+ * Includes
+ ******************************************************************************/
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "mes_peakfinder.h"
+#include "mes_workspace.h"
+
+ /*******************************************************************************
+  * Defines
+  ******************************************************************************/
+
+/*!
+ * @brief Scale of the MAD of first differences to the standard deviation of white noise.
+ *
+ * For Gaussian noise of deviation sigma, first differences have deviation sigma * sqrt(2)
+ * and a MAD of 0.6745 times that, so sigma = MAD / (0.6745 * sqrt(2)).
+ */
+#define NOISE_DIFFERENCE_MAD_SCALE 1.0483f
+
+/*!
+ * @brief Weight of a new sweep in the per-channel noise estimate once it is settled.
+ *
+ * The first sweeps are averaged with equal weights; afterwards the estimate follows the
+ * channel with this exponential weight.
+ */
+#define NOISE_UPDATE_WEIGHT 0.125f
+
+  /*******************************************************************************
+   * Functions
+   ******************************************************************************/
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+	/**
+	 * @brief Returns the k-th smallest of count values in O(n), reordering them.
+	 *
+	 * Quickselect with median-of-three pivots, falling back to heapselect on the remaining
+	 * range if the partitions stop shrinking, so adversarial inputs stay O(n log n) at worst.
+	 *
+	 * @param values The values, reordered in place.
+	 * @param count The number of values.
+	 * @param k The rank, 0 for the smallest.
+	 * @return The k-th smallest value.
+	 */
+	float introselect(float values[], int count, int k);
+
+	/**
+	 * @brief Returns the workspace size needed by estimateNoise.
+	 *
+	 * @param size The size of the arrays that will be processed.
+	 * @return The number of workspace bytes.
+	 */
+	size_t noiseWorkspaceSize(int size);
+
+	/**
+	 * @brief Estimates the noise deviation of the phase angle of a sweep.
+	 *
+	 * Uses the median absolute deviation of the first differences, which ignores slow drift
+	 * and is not lifted by peaks or isolated glitches.
+	 *
+	 * @param a The raw data array.
+	 * @param size The size of the array.
+	 * @param workspace Scratch memory of at least noiseWorkspaceSize bytes, released on return.
+	 * @return The noise standard deviation, or -1 if the workspace is too small or size < 2.
+	 */
+	float estimateNoise(const MqsRawDataPoint_t a[], int size, MqsWorkspace_t *workspace);
+
+	/**
+	 * @brief Initialises an empty per-channel noise estimate.
+	 */
+	void noiseInit(MqsNoiseEstimate_t *noise);
+
+	/**
+	 * @brief Folds the noise of a new sweep into the per-channel estimate.
+	 *
+	 * @param noise Pointer to the estimate.
+	 * @param a The raw data array.
+	 * @param size The size of the array.
+	 * @param workspace Scratch memory of at least noiseWorkspaceSize bytes, released on return.
+	 * @return False if the sweep could not be estimated; the estimate is then unchanged.
+	 */
+	bool noiseUpdate(MqsNoiseEstimate_t *noise, const MqsRawDataPoint_t a[], int size, MqsWorkspace_t *workspace);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* NOISE_H */
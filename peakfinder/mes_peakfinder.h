@@ -5,11 +5,88 @@
  * Includes
  ******************************************************************************/
 //#include "mqs/mqs_def.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "mes_workspace.h"
 
  /*******************************************************************************
   * Defines
   ******************************************************************************/
 
+/*!
+ * @brief Defines the noise tolerance level for validating edge case climbing peaks.
+ *
+ * This constant represents the threshold for noise tolerance used in determining whether a peak 
+ * is still climbing at the end of a dataset. It is used in the context of peak analysis to 
+ * distinguish between genuine rising peaks and minor fluctuations that could be attributed 
+ * to noise. A lower value indicates stricter criteria for a peak to be considered as climbing.
+ */
+#define NOISE_TOLERANCE 0.9f 
+
+/*!
+ * @brief Defines the threshold for identifying edge case peaks in a dataset.
+ *
+ * This constant sets the threshold for defining edge case peaks. An edge case peak is 
+ * identified when the peak is near the end of the dataset and has not reached its maximum 
+ * (climax) within the dataset's interval. This threshold value determines how close to the 
+ * end of the dataset a peak must be to be considered an edge case. It is used to decide 
+ * whether to check if a peak is still climbing or if it may continue in a subsequent dataset.
+ */
+#define PEAK_THRESHOLD  30
+
+/*!
+ * @brief Acceptance criteria for a candidate peak.
+ *
+ * A candidate is accepted when its prominence exceeds MIN_PEAK_PROMINENCE and its FWHM
+ * exceeds MIN_PEAK_FWHM. Narrow candidates are skipped and the search is retried, up to
+ * MAX_PEAK_ATTEMPTS times.
+ */
+#define MIN_PEAK_PROMINENCE 18.0f
+#define MIN_PEAK_FWHM       15
+#define MAX_PEAK_ATTEMPTS   3
+
+/*!
+ * @brief Width of the sample indices returned by the detectors.
+ *
+ * Indices are 32-bit by default, so high-resolution and concatenated sweeps are only limited
+ * by memory. MCU builds can define MES_INDEX_16BIT to keep the results compact, which limits
+ * sweeps to MES_INDEX_MAX + 1 points; longer sweeps are rejected instead of truncated.
+ */
+#ifdef MES_INDEX_16BIT
+#define MES_INDEX_MAX UINT16_MAX
+#else
+#define MES_INDEX_MAX UINT32_MAX
+#endif
+
+/*!
+ * @brief Limits of the smoothing filter of MqsPeakConfig_t.
+ *
+ * Longer windows are clamped to MES_SMOOTH_MAX_WINDOW samples, higher polynomial orders to
+ * MES_SMOOTH_MAX_ORDER.
+ */
+#define MES_SMOOTH_MAX_WINDOW 25
+#define MES_SMOOTH_MAX_ORDER  6
+
+/*!
+ * @brief Highest degree of the baseline polynomial of MqsBaseline_t.
+ */
+#define MES_BASELINE_MAX_DEGREE 3
+
+/*!
+ * @brief Number of sweeps analysed side by side by processPeakBatch.
+ *
+ * One lane per sweep; 16 lanes fill an AVX-512 register, 8 lanes an AVX2 register.
+ * Can be overridden at compile time to match the target vector width.
+ */
+#ifndef MES_BATCH_LANES
+#if defined(__AVX512F__)
+#define MES_BATCH_LANES 16
+#else
+#define MES_BATCH_LANES 8
+#endif
+#endif
+
   /*******************************************************************************
    * Type definitions
    ******************************************************************************/
@@ -18,6 +95,155 @@ typedef struct {
 	float impedance;
 } MqsRawDataPoint_t;
 
+/*!
+ * @brief Sample index, see MES_INDEX_16BIT.
+ */
+#ifdef MES_INDEX_16BIT
+typedef uint16_t MqsIndex_t;
+#else
+typedef uint32_t MqsIndex_t;
+#endif
+
+/*!
+ * @brief Inclusive range of sample indices [left, right].
+ */
+typedef struct {
+	int left;
+	int right;
+} MqsInterval_t;
+
+/*!
+ * @brief Interpolation used to locate the half-height crossings of a peak.
+ */
+typedef enum {
+	MQS_INTERP_LINEAR = 0,	/**< Straight line between the samples around the crossing. */
+	MQS_INTERP_CUBIC		/**< Catmull-Rom cubic through the four samples around the crossing. */
+} MqsInterpolation_t;
+
+/*!
+ * @brief Ends of the sweep at which a peak is truncated, as bit flags.
+ *
+ * Truncation is only reported; the peak is accepted or rejected by the usual prominence and
+ * FWHM rules, and the caller decides whether to fetch the flagged neighbouring segment.
+ */
+typedef enum {
+	MQS_EDGE_NONE = 0,	/**< The peak lies within the sweep. */
+	MQS_EDGE_LEFT = 1,	/**< Still falling from the first sample, the previous segment holds its top. */
+	MQS_EDGE_RIGHT = 2,	/**< Still climbing at the last sample, the next segment holds its top. */
+	MQS_EDGE_BOTH = 3	/**< Truncated at both ends. */
+} MqsEdge_t;
+
+/*!
+ * @brief Model used to refine the apex of a peak between samples.
+ */
+typedef enum {
+	MQS_APEX_PARABOLIC = 0,	/**< Parabola through the peak sample and its neighbours. */
+	MQS_APEX_GAUSSIAN		/**< Parabola through the logarithms, exact for a Gaussian peak. */
+} MqsApexRefinement_t;
+
+/*!
+ * @brief Smoothing filter applied to the phase angle during detection.
+ */
+typedef enum {
+	MQS_SMOOTH_NONE = 0,		/**< Raw samples. */
+	MQS_SMOOTH_MOVING_AVERAGE,	/**< Mean of the window. */
+	MQS_SMOOTH_SAVITZKY_GOLAY	/**< Least-squares polynomial through the window, keeps peak heights. */
+} MqsSmoothing_t;
+
+/*!
+ * @brief Polynomial baseline of one channel, cached across sweeps.
+ *
+ * The polynomial is expressed in the normalised abscissa t = i * scale - 1, which runs from
+ * -1 at the first sample to 1 at the last. It is fitted and refreshed by the functions of
+ * mes_baseline.h; the detector only evaluates it.
+ */
+typedef struct {
+	int degree;				/**< Degree of the polynomial, 1 for linear drift, 2 for quadratic. */
+	int refreshInterval;	/**< Sweeps the fit is reused for before it is refined, at least 1. */
+	int age;				/**< Sweeps since the last fit. */
+	int size;				/**< Length of the sweep the fit belongs to. */
+	float scale;			/**< 2 / (size - 1). */
+	float coefficients[MES_BASELINE_MAX_DEGREE + 1]; /**< Coefficients of t^0 to t^degree. */
+	bool valid;				/**< False until the first fit. */
+} MqsBaseline_t;
+
+/*!
+ * @brief Noise deviation of one channel, updated with every sweep by noiseUpdate (mes_noise.h).
+ */
+typedef struct {
+	float sigma;	/**< Standard deviation of the phase angle noise. */
+	int sweeps;		/**< Sweeps folded into the estimate. */
+} MqsNoiseEstimate_t;
+
+/*!
+ * @brief Options of processPeakDetailed. A NULL configuration selects the defaults.
+ *
+ * With smoothing enabled, every stage of the detector reads the phase angle through the
+ * filter, computed from the raw samples as they are read; no smoothed copy is written.
+ */
+typedef struct {
+	MqsInterpolation_t interpolation;
+	MqsApexRefinement_t apexRefinement;
+	MqsSmoothing_t smoothing;	/**< Filter, MQS_SMOOTH_NONE by default. */
+	int smoothingWindow;		/**< Odd window length in samples, at least 3 to enable the filter. */
+	int smoothingOrder;			/**< Polynomial order of the Savitzky-Golay filter, typically 2 to 4. */
+	float unwrapPeriod;			/**< Wrap period of the phase angle, e.g. 360 degrees, or 0 if not wrapped.
+								 *   Wrapped sweeps are unwrapped in place before the search. */
+	int despikeHalfWindow;		/**< Half window of the Hampel filter, or 0 to keep glitches.
+								 *   Glitches are replaced in place before the search. */
+	float despikeSigma;			/**< Hampel threshold in standard deviations, typically 3. */
+	float despikeMinDeviation;	/**< Deviations from the median up to this phase angle are never replaced. */
+	MqsBaseline_t *baseline;	/**< Baseline cache of the channel, or NULL to keep the drift.
+								 *   It is refreshed as due and subtracted from every sample read. */
+	MqsNoiseEstimate_t *noise;	/**< Noise estimate of the channel, or NULL for the fixed thresholds.
+								 *   It is updated with every sweep; the thresholds below then
+								 *   replace MIN_PEAK_PROMINENCE and NOISE_TOLERANCE. */
+	float prominenceSigma;		/**< Minimum prominence in noise deviations, e.g. 6. */
+	float noiseToleranceSigma;	/**< Tolerance of isPeakClimbing in noise deviations, e.g. 0.3. */
+} MqsPeakConfig_t;
+
+/*!
+ * @brief Detailed description of the peak found by processPeakDetailed.
+ */
+typedef struct {
+	MqsIndex_t peakIndex;	/**< Index of the peak sample. */
+	float peakValue;		/**< Phase angle at peakIndex. */
+	float prominence;		/**< Prominence of the peak. */
+	int fwhm;				/**< FWHM in whole samples, as used by the acceptance criteria. */
+	float fwhmInterpolated;	/**< FWHM in samples between the interpolated half-height crossings. */
+	float leftCrossing;		/**< Fractional index of the left half-height crossing. */
+	float rightCrossing;	/**< Fractional index of the right half-height crossing. */
+	float apexPosition;		/**< Fractional index of the refined apex. */
+	float apexValue;		/**< Phase angle at the refined apex. */
+	float sharpness;		/**< Second difference of the phase angle at peakIndex, negative at a maximum. */
+	int despikedCount;		/**< Samples replaced by the Hampel filter before the search. */
+	const MqsIndex_t *despikedIndices;	/**< Indices of the replaced samples in increasing order, in the
+										 *   workspace; valid until the workspace is used again. */
+	float noiseSigma;		/**< Noise deviation the thresholds were scaled with, 0 for the fixed thresholds. */
+	bool isEdgeCase;		/**< True if the peak is still climbing at the end of the sweep. */
+	MqsEdge_t truncatedEdge;	/**< Ends at which the peak continues into the neighbouring segment. */
+} MqsPeakResult_t;
+
+/*!
+ * @brief Paired description of the phase peak and the impedance minimum of a sweep.
+ *
+ * The impedance is characterised between the prominence boundaries of the phase peak, the
+ * nearest higher phase samples on either side, or over the whole sweep without a candidate.
+ * Offsets are in samples, positive when the impedance minimum lies after the phase peak;
+ * multiply by the frequency step of the sweep to obtain a frequency offset.
+ */
+typedef struct {
+	MqsPeakResult_t phase;		/**< Phase peak, as found by processPeakDetailed. */
+	bool phaseAccepted;			/**< True if the phase peak meets the acceptance criteria. */
+	MqsIndex_t impedanceIndex;	/**< Index of the impedance minimum. */
+	float impedanceValue;		/**< Impedance at impedanceIndex. */
+	float impedanceDepth;		/**< Depth of the minimum below the highest impedance within the phase peak's bounds. */
+	float impedanceProminence;	/**< Depth below the lower of the highest impedances on either side within the bounds. */
+	float impedanceWidth;		/**< Width in samples between the interpolated half-prominence crossings. */
+	float frequencyOffset;		/**< impedanceIndex - phase.apexPosition. */
+	bool isConsistent;			/**< True if the impedance minimum lies within the phase peak's half-height crossings. */
+} MqsDualPeakResult_t;
+
    /*******************************************************************************
 	* Functions
 	******************************************************************************/
@@ -33,7 +259,109 @@ extern "C" {
 	 * @param peakIndex Pointer to the variable to store the peak index.
 	 * @return true if the peak is successfully processed, false otherwise.
 	 */
-	bool processPeak(MqsRawDataPoint_t a[], int size, uint16_t *peakIndex, bool* isEdgeCase);
+	bool processPeak(MqsRawDataPoint_t a[], int size, MqsIndex_t *peakIndex, bool* isEdgeCase);
+
+	/**
+	 * @brief Processes the peak in the given raw data array and reports its full description.
+	 *
+	 * Same detection and acceptance rules as processPeak. In addition to the integer fields,
+	 * the result holds the FWHM between interpolated half-height crossings and the apex
+	 * refined between samples.
+	 *
+	 * @param a Pointer to the raw data array.
+	 * @param size The size of the array.
+	 * @param config Interpolation and smoothing options, or NULL for linear crossings, a parabolic
+	 *               apex and no smoothing.
+	 * @param workspace Scratch memory of at least processPeakWorkspaceSize bytes, may be NULL
+	 *                  if that size is 0. Released before returning; result->despikedIndices
+	 *                  points into it and stays valid until the workspace is used again.
+	 * @param result Pointer to the structure receiving the peak description.
+	 * @return true if the peak is successfully processed, false otherwise.
+	 */
+	bool processPeakDetailed(MqsRawDataPoint_t a[], int size, const MqsPeakConfig_t *config, MqsWorkspace_t *workspace, MqsPeakResult_t *result);
+
+	/**
+	 * @brief Returns the workspace size needed by processPeakDetailed.
+	 *
+	 * @param size The size of the arrays that will be processed.
+	 * @param config The configuration that will be used, or NULL for the defaults.
+	 * @return The number of workspace bytes, 0 if no workspace is needed.
+	 */
+	size_t processPeakWorkspaceSize(int size, const MqsPeakConfig_t *config);
+
+	/**
+	 * @brief Detects the phase peak, then measures the impedance minimum within its bounds.
+	 *
+	 * The phase peak is detected and validated as by processPeakDetailed. The impedance minimum,
+	 * its depth, prominence and half-prominence width are then measured in one pass between the
+	 * prominence boundaries of the phase peak.
+	 *
+	 * @param a Pointer to the raw data array.
+	 * @param size The size of the array.
+	 * @param config Interpolation and smoothing options for the phase channel, or NULL for the
+	 *               defaults.
+	 * @param workspace Scratch memory of at least processPeakWorkspaceSize bytes, may be NULL
+	 *                  if that size is 0.
+	 * @param result Pointer to the structure receiving both channels.
+	 * @return True if the phase peak is accepted and consistent with the impedance minimum.
+	 */
+	bool processPeakDualChannel(MqsRawDataPoint_t a[], int size, const MqsPeakConfig_t *config, MqsWorkspace_t *workspace, MqsDualPeakResult_t *result);
+
+	/**
+	 * @brief Finds the best qualifying peak in each of several index windows (bands).
+	 *
+	 * Every band is searched in place, with prominence and FWHM bounded by the band.
+	 * Bands differ in length and in drift and noise, so a non-NULL config->baseline or
+	 * config->noise must point to an array of numBands caches, entry n serving band n.
+	 *
+	 * @param a Pointer to the raw data array.
+	 * @param size The size of the array.
+	 * @param bands The index windows to search, clipped to the array.
+	 * @param numBands The number of bands.
+	 * @param config Detection options with per-band caches, or NULL for the defaults.
+	 * @param workspace Scratch memory of at least processPeakWorkspaceSize bytes for the
+	 *                  longest band. With despiking, the replaced indices of every band are
+	 *                  kept in it, so add WORKSPACE_BYTES(length, MqsIndex_t) per band.
+	 *                  processPeakWorkspaceSize already includes the alignment padding.
+	 * @param results Caller-owned array of numBands results, indices relative to a.
+	 * @param accepted Caller-owned array of numBands flags, true if the band holds a valid peak.
+	 * @return The number of bands with a valid peak.
+	 */
+	int processPeakBands(MqsRawDataPoint_t a[], int size, const MqsInterval_t bands[], int numBands,
+						 const MqsPeakConfig_t *config, MqsWorkspace_t *workspace, MqsPeakResult_t results[], bool accepted[]);
+
+	/**
+	 * @brief Transposes equal-length sweeps into the lane-interleaved batch layout.
+	 *
+	 * Sample i of sweep l is stored at interleaved[i * MES_BATCH_LANES + l]. Lanes beyond
+	 * numSweeps are zero filled and should be left out of the lane mask.
+	 *
+	 * @param sweeps Array of numSweeps pointers to raw data arrays.
+	 * @param numSweeps Number of sweeps, at most MES_BATCH_LANES.
+	 * @param size The size of every sweep.
+	 * @param interleaved Output buffer of size * MES_BATCH_LANES floats.
+	 */
+	void transposeSweepBatch(MqsRawDataPoint_t* sweeps[], int numSweeps, int size, float interleaved[]);
+
+	/**
+	 * @brief Processes up to MES_BATCH_LANES sweeps at once in the lane-interleaved layout.
+	 *
+	 * Applies the same argmax, prominence, FWHM, retry and edge rules as processPeak
+	 * to every lane in laneMask.
+	 *
+	 * @param interleaved Lane-interleaved phase angles, as produced by transposeSweepBatch.
+	 * @param size The size of every sweep.
+	 * @param laneMask Bit l set if lane l holds a sweep to analyse.
+	 * @param peakIndex Array of MES_BATCH_LANES entries receiving the peak index per lane.
+	 * @param isEdgeCase Array of MES_BATCH_LANES entries receiving the edge case flag per lane,
+	 *                   written for every lane.
+	 * @param truncatedEdge Array of MES_BATCH_LANES entries receiving the truncated ends per
+	 *                      lane, may be NULL.
+	 * @return Mask of the lanes whose peak was accepted, 0 if the indices of the sweeps do
+	 *         not fit MqsIndex_t.
+	 */
+	uint32_t processPeakBatch(const float interleaved[], int size, uint32_t laneMask, MqsIndex_t peakIndex[], bool isEdgeCase[],
+							  MqsEdge_t truncatedEdge[]);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,100 @@
+#ifndef PERSISTENCE_H
+#define PERSISTENCE_H
+
+/*******************************************************************************
+ * Includes
+ ******************************************************************************/
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "mes_peakfinder.h"
+#include "mes_workspace.h"
+
+ /*******************************************************************************
+  * Defines
+  ******************************************************************************/
+
+/*!
+ * @brief Capacity of the peak table needed for a sweep of the given size.
+ *
+ * A sweep of n samples has at most (n + 1) / 2 local maxima.
+ */
+#define PERSISTENCE_MAX_PEAKS(size) (((size) + 1) / 2)
+
+  /*******************************************************************************
+   * Type definitions
+   ******************************************************************************/
+
+/*!
+ * @brief One peak of the persistence hierarchy.
+ *
+ * The peak is born at its maximum and dies at the saddle where its region merges into the
+ * region of a higher peak. The persistence (birth - death) is the topographic prominence of
+ * the peak, measured down to the higher of its two saddles. The highest peak never merges;
+ * it dies at the global minimum.
+ *
+ * The detector measures prominence differently: processPeakDetailed subtracts the lowest
+ * sample between the nearest higher samples on either side, i.e. the lower base. That value
+ * is stored as well, so a MIN_PEAK_PROMINENCE style cut-off can be tuned on the table; it
+ * is never smaller than the persistence and does not follow the order of the table.
+ */
+typedef struct {
+	int peakIndex;		/**< Index of the maximum. */
+	int saddleIndex;	/**< Index of the saddle where the peak merges into a higher one. */
+	float birth;		/**< Phase angle at peakIndex. */
+	float death;		/**< Phase angle at saddleIndex. */
+	float persistence;	/**< birth - death. */
+	float prominence;	/**< birth minus the lower base, as findProminence reports it on the raw sweep. */
+} MqsPersistencePeak_t;
+
+   /*******************************************************************************
+	* Functions
+	******************************************************************************/
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+	/**
+	 * @brief Returns the workspace size needed by buildPersistence.
+	 *
+	 * @param size The size of the arrays that will be processed.
+	 * @return The number of workspace bytes.
+	 */
+	size_t persistenceWorkspaceSize(int size);
+
+	/**
+	 * @brief Builds the persistence hierarchy of all peaks of a sweep in O(n log n).
+	 *
+	 * @param a The raw data array.
+	 * @param size The size of the array.
+	 * @param workspace Scratch memory of at least persistenceWorkspaceSize bytes.
+	 * @param peaks Caller-owned table of at least PERSISTENCE_MAX_PEAKS(size) entries,
+	 *              filled in order of decreasing persistence.
+	 * @param capacity The number of entries of the table.
+	 * @return The number of peaks, or -1 if the workspace or the table is too small.
+	 */
+	int buildPersistence(MqsRawDataPoint_t a[], int size, MqsWorkspace_t *workspace, MqsPersistencePeak_t peaks[], int capacity);
+
+	/**
+	 * @brief Counts the peaks whose persistence exceeds a threshold.
+	 *
+	 * Since the table is sorted, these are its first entries; the search costs O(log n) and
+	 * reading the k peaks O(k), for any threshold, without re-running the detection.
+	 *
+	 * The persistence is the topographic prominence, not the lower-base prominence that
+	 * processPeakDetailed compares with MIN_PEAK_PROMINENCE, so this is not the set of peaks
+	 * the detector would accept; compare the prominence field for that.
+	 *
+	 * @param peaks The table filled by buildPersistence.
+	 * @param count The number of peaks in the table.
+	 * @param minPersistence The threshold.
+	 * @return The number of leading entries with persistence > minPersistence.
+	 */
+	int queryPersistence(const MqsPersistencePeak_t peaks[], int count, float minPersistence);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PERSISTENCE_H */
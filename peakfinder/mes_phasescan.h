@@ -0,0 +1,212 @@
+#ifndef PHASESCAN_H
+#define PHASESCAN_H
+
+/*******************************************************************************
+ * Includes
+ ******************************************************************************/
+#include <stdbool.h>
+#include <stdint.h>
+#include "mes_peakfinder.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+ /*******************************************************************************
+  * Defines
+  ******************************************************************************/
+
+/*!
+ * @brief Number of samples compared per step by the threshold scans.
+ *
+ * Each step compares a whole block against the threshold into a bit mask and locates the
+ * first hit with a bit scan. With AVX2 the block is four loads, two shuffles that separate
+ * the phase angles from the impedances, two vector compares and two movemasks; otherwise
+ * the mask is built one sample at a time.
+ */
+#define PHASE_SCAN_BLOCK 16
+
+  /*******************************************************************************
+   * Type definitions
+   ******************************************************************************/
+
+/*!
+ * @brief Comparison applied to the phase angle by the threshold scans.
+ */
+typedef enum {
+	PHASE_AT_OR_BELOW = 0,	/**< phaseAngle <= threshold, the half-height crossings. */
+	PHASE_BELOW,			/**< phaseAngle < threshold. */
+	PHASE_ABOVE				/**< phaseAngle > threshold. */
+} PhaseTest_t;
+
+  /*******************************************************************************
+   * Internal helpers
+   ******************************************************************************/
+
+/*!
+ * @brief Returns the position of the lowest set bit of a non-zero mask.
+ */
+static inline int lowestSetBit(uint32_t mask)
+{
+#if defined(__GNUC__) || defined(__clang__)
+	return __builtin_ctz(mask);
+#else
+	int bit = 0;
+	while (!(mask & 1u))
+	{
+		mask >>= 1;
+		bit++;
+	}
+	return bit;
+#endif
+}
+
+/*!
+ * @brief Returns the position of the highest set bit of a non-zero mask.
+ */
+static inline int highestSetBit(uint32_t mask)
+{
+#if defined(__GNUC__) || defined(__clang__)
+	return 31 - __builtin_clz(mask);
+#else
+	int bit = 31;
+	while (!(mask & 0x80000000u))
+	{
+		mask <<= 1;
+		bit--;
+	}
+	return bit;
+#endif
+}
+
+/*!
+ * @brief Applies the test to one phase angle.
+ */
+static inline bool phaseTest(float value, float threshold, PhaseTest_t test)
+{
+	switch (test)
+	{
+	case PHASE_BELOW:
+		return value < threshold;
+	case PHASE_ABOVE:
+		return value > threshold;
+	default:
+		return value <= threshold;
+	}
+}
+
+#if defined(__AVX2__)
+/*!
+ * @brief Compares the phase angles of 8 consecutive points, returned in sample order.
+ */
+static inline uint32_t phaseTestMask8(const MqsRawDataPoint_t a[], __m256 threshold, PhaseTest_t test)
+{
+	// {p0 z0 p1 z1 p2 z2 p3 z3} and {p4 z4 ... p7 z7} shuffle to {p0 p1 p4 p5 p2 p3 p6 p7}
+	__m256 lo = _mm256_loadu_ps(&a[0].phaseAngle);
+	__m256 hi = _mm256_loadu_ps(&a[4].phaseAngle);
+	__m256 phase = _mm256_shuffle_ps(lo, hi, _MM_SHUFFLE(2, 0, 2, 0));
+	phase = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(phase), _MM_SHUFFLE(3, 1, 2, 0)));
+
+	__m256 hit;
+	switch (test)
+	{
+	case PHASE_BELOW:
+		hit = _mm256_cmp_ps(phase, threshold, _CMP_LT_OQ);
+		break;
+	case PHASE_ABOVE:
+		hit = _mm256_cmp_ps(phase, threshold, _CMP_GT_OQ);
+		break;
+	default:
+		hit = _mm256_cmp_ps(phase, threshold, _CMP_LE_OQ);
+		break;
+	}
+	return (uint32_t)_mm256_movemask_ps(hit);
+}
+#endif
+
+/*!
+ * @brief Tests PHASE_SCAN_BLOCK consecutive phase angles; bit k is set if a[k] passes.
+ */
+static inline uint32_t phaseTestBlock(const MqsRawDataPoint_t a[], float threshold, PhaseTest_t test)
+{
+#if defined(__AVX2__)
+	__m256 t = _mm256_set1_ps(threshold);
+	return phaseTestMask8(a, t, test) | (phaseTestMask8(a + 8, t, test) << 8);
+#else
+	uint32_t mask = 0;
+	for (int k = 0; k < PHASE_SCAN_BLOCK; k++)
+	{
+		mask |= (uint32_t)phaseTest(a[k].phaseAngle, threshold, test) << k;
+	}
+	return mask;
+#endif
+}
+
+/*!
+ * @brief Finds the first sample passing the test, scanning to the right.
+ *
+ * @param a The array of data points (MqsRawDataPoint_t) to search.
+ * @param first The first index to examine.
+ * @param last The last index to examine.
+ * @param threshold The height to compare against.
+ * @param test The comparison of the phase angle against the threshold.
+ * @return The index of the first sample in [first, last] passing the test, or -1.
+ */
+static inline int scanPhaseRight(const MqsRawDataPoint_t a[], int first, int last, float threshold, PhaseTest_t test)
+{
+	int i = first;
+
+	for (; i + PHASE_SCAN_BLOCK - 1 <= last; i += PHASE_SCAN_BLOCK)
+	{
+		uint32_t mask = phaseTestBlock(&a[i], threshold, test);
+		if (mask)
+		{
+			return i + lowestSetBit(mask);
+		}
+	}
+
+	for (; i <= last; i++)
+	{
+		if (phaseTest(a[i].phaseAngle, threshold, test))
+		{
+			return i;
+		}
+	}
+	return -1;
+}
+
+/*!
+ * @brief Finds the first sample passing the test, scanning to the left.
+ *
+ * @param a The array of data points (MqsRawDataPoint_t) to search.
+ * @param first The first (highest) index to examine.
+ * @param last The last (lowest) index to examine.
+ * @param threshold The height to compare against.
+ * @param test The comparison of the phase angle against the threshold.
+ * @return The index of the first sample in [last, first] passing the test, or -1.
+ */
+static inline int scanPhaseLeft(const MqsRawDataPoint_t a[], int first, int last, float threshold, PhaseTest_t test)
+{
+	int i = first;
+
+	// Blocks are loaded in ascending order, the nearest hit is the highest set bit
+	for (; i - PHASE_SCAN_BLOCK + 1 >= last; i -= PHASE_SCAN_BLOCK)
+	{
+		uint32_t mask = phaseTestBlock(&a[i - PHASE_SCAN_BLOCK + 1], threshold, test);
+		if (mask)
+		{
+			return i - PHASE_SCAN_BLOCK + 1 + highestSetBit(mask);
+		}
+	}
+
+	for (; i >= last; i--)
+	{
+		if (phaseTest(a[i].phaseAngle, threshold, test))
+		{
+			return i;
+		}
+	}
+	return -1;
+}
+
+#endif /* PHASESCAN_H */
@@ -0,0 +1,71 @@
+#ifndef PHASEUNWRAP_H
+#define PHASEUNWRAP_H
+
+/*******************************************************************************
+ * Includes
+ ******************************************************************************/
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "mes_peakfinder.h"
+
+ /*******************************************************************************
+  * Defines
+  ******************************************************************************/
+
+/*!
+ * @brief Wrap period of front ends reporting the phase angle in degrees within +-180.
+ */
+#define PHASE_PERIOD_DEGREES 360.0f
+
+  /*******************************************************************************
+   * Type definitions
+   ******************************************************************************/
+
+/*!
+ * @brief State of a phase unwrapper, carried from one segment of a sweep to the next.
+ *
+ * Unwrapping a sweep in several segments with the same state gives the same result as
+ * unwrapping it at once, so the two arrays of the overlap detector stay continuous.
+ */
+typedef struct {
+	float period;	/**< Wrap period, e.g. PHASE_PERIOD_DEGREES. */
+	float offset;	/**< Multiple of the period added to the current sample. */
+	float previous;	/**< Wrapped phase angle of the last sample. */
+	bool started;	/**< False until the first sample has been seen. */
+} MqsPhaseUnwrap_t;
+
+   /*******************************************************************************
+	* Functions
+	******************************************************************************/
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+	/**
+	 * @brief Initialises an unwrapper for a new sweep.
+	 *
+	 * @param state Pointer to the state.
+	 * @param period The wrap period of the phase angle.
+	 */
+	void phaseUnwrapInit(MqsPhaseUnwrap_t *state, float period);
+
+	/**
+	 * @brief Unwraps the phase angle of a segment in place.
+	 *
+	 * Every jump between consecutive samples larger than half a period is taken as a wrap and
+	 * compensated by a multiple of the period, so the fake peaks and steps created by the
+	 * wrapping disappear before detection.
+	 *
+	 * @param state Pointer to the state, carried over from the previous segment.
+	 * @param a The segment.
+	 * @param size The size of the segment.
+	 */
+	void phaseUnwrap(MqsPhaseUnwrap_t *state, MqsRawDataPoint_t a[], int size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PHASEUNWRAP_H */
@@ -0,0 +1,114 @@
+#ifndef RESONANCE_H
+#define RESONANCE_H
+
+/*******************************************************************************
+ * Includes
+ ******************************************************************************/
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "mes_peakfinder.h"
+
+  /*******************************************************************************
+   * Type definitions
+   ******************************************************************************/
+
+/*!
+ * @brief A maximum or minimum of the impedance of a sweep.
+ *
+ * The prominence is the smaller of the two drops (rises for a minimum) towards the
+ * neighbouring extrema of the opposite kind, or towards the most extreme sample between the
+ * extremum and the end of the sweep when there is no neighbour on that side.
+ */
+typedef struct {
+	MqsIndex_t index;	/**< Index of the extremum. */
+	float value;		/**< Impedance at index. */
+	float prominence;	/**< Height above (depth below) the neighbouring opposite extrema. */
+	bool isPeak;		/**< True for a maximum, false for a minimum. */
+} MqsExtremum_t;
+
+/*!
+ * @brief A resonance (impedance minimum) and the anti-resonance (maximum) that follows it.
+ */
+typedef struct {
+	MqsIndex_t resonanceIndex;		/**< Index of the impedance minimum. */
+	MqsIndex_t antiResonanceIndex;	/**< Index of the impedance maximum. */
+	float resonanceFrequency;		/**< fr, frequency of resonanceIndex. */
+	float antiResonanceFrequency;	/**< fa, frequency of antiResonanceIndex. */
+	float couplingSquared;			/**< Effective coupling coefficient keff^2 = (fa^2 - fr^2) / fa^2. */
+} MqsResonancePair_t;
+
+/*!
+ * @brief A zero crossing of the phase angle.
+ */
+typedef struct {
+	MqsIndex_t index;	/**< Index of the last sample before the crossing. */
+	float position;		/**< Fractional index of the crossing, linearly interpolated. */
+	float slope;		/**< Change of the phase angle per sample across the crossing. */
+	bool rising;		/**< True if the phase angle goes from negative to positive. */
+} MqsZeroCrossing_t;
+
+   /*******************************************************************************
+	* Functions
+	******************************************************************************/
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+	/**
+	 * @brief Finds the maxima and minima of the impedance of a sweep in a single scan.
+	 *
+	 * The scan tracks the running maximum and minimum and confirms an extremum once the
+	 * impedance has moved away from it by more than minProminence, so maxima and minima
+	 * alternate and noise smaller than the hysteresis is ignored. Extrema at the very ends of
+	 * the sweep, which are never confirmed, are not reported.
+	 *
+	 * @param a The raw data array.
+	 * @param size The size of the array.
+	 * @param minProminence The hysteresis, in impedance units.
+	 * @param extrema Caller-owned table receiving the extrema in order of index.
+	 * @param capacity The number of entries of the table.
+	 * @return The number of extrema, -1 if the table is too small, or 0 if the sweep is
+	 *         too long for MES_INDEX_16BIT.
+	 */
+	int findImpedanceExtrema(MqsRawDataPoint_t a[], int size, float minProminence, MqsExtremum_t extrema[], int capacity);
+
+	/**
+	 * @brief Pairs every minimum with the maximum that follows it.
+	 *
+	 * Frequencies are start + index * step, so the coupling coefficient is computed from the
+	 * frequencies of the sweep rather than from sample indices.
+	 *
+	 * @param extrema The table filled by findImpedanceExtrema.
+	 * @param count The number of extrema.
+	 * @param startFrequency The frequency of the first sample.
+	 * @param frequencyStep The frequency step between samples.
+	 * @param pairs Caller-owned table receiving the pairs in order of frequency.
+	 * @param capacity The number of entries of the table.
+	 * @return The number of pairs, at most capacity.
+	 */
+	int pairResonances(const MqsExtremum_t extrema[], int count, float startFrequency, float frequencyStep, MqsResonancePair_t pairs[], int capacity);
+
+	/**
+	 * @brief Finds the zero crossings of the phase angle, with hysteresis.
+	 *
+	 * A crossing is only reported once the phase angle has gone from beyond -hysteresis to
+	 * beyond +hysteresis or back, so chatter around zero yields a single crossing, located
+	 * at the last sign change before the band was left.
+	 *
+	 * @param a The raw data array.
+	 * @param size The size of the array.
+	 * @param hysteresis Half width of the band around zero, in phase units.
+	 * @param crossings Caller-owned table receiving the crossings in order of index.
+	 * @param capacity The number of entries of the table.
+	 * @return The number of crossings, at most capacity, or 0 if the sweep is too long for
+	 *         MES_INDEX_16BIT.
+	 */
+	int findZeroCrossings(MqsRawDataPoint_t a[], int size, float hysteresis, MqsZeroCrossing_t crossings[], int capacity);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* RESONANCE_H */
@@ -0,0 +1,182 @@
+#ifndef SWEEPARCHIVE_H
+#define SWEEPARCHIVE_H
+
+/*******************************************************************************
+ * Includes
+ ******************************************************************************/
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "mes_peakfinder.h"
+
+ /*******************************************************************************
+  * Defines
+  ******************************************************************************/
+
+/*!
+ * @brief Binary sweep archive layout (all fields little-endian).
+ *
+ *   offset 0   MqsArchiveHeader_t (64 bytes)
+ *   offset 64  sweep payloads, each an array of MqsRawDataPoint_t starting on a
+ *              SWEEP_ARCHIVE_ALIGNMENT boundary
+ *   indexOffset  sweepCount MqsArchiveIndexEntry_t records (32 bytes each)
+ *
+ * The index is written last so sweeps can be appended without knowing their number in
+ * advance; the header is patched when the archive is finished. A reader maps the file and
+ * hands the payloads to the detectors in place.
+ */
+#define SWEEP_ARCHIVE_MAGIC     0x4153514Du /* "MQSA" */
+#define SWEEP_ARCHIVE_VERSION   1
+#define SWEEP_ARCHIVE_ALIGNMENT 64
+
+  /*******************************************************************************
+   * Type definitions
+   ******************************************************************************/
+
+/*!
+ * @brief Fixed archive header at the start of the file.
+ */
+typedef struct {
+	uint32_t magic;				/**< SWEEP_ARCHIVE_MAGIC. */
+	uint16_t version;			/**< SWEEP_ARCHIVE_VERSION. */
+	uint16_t headerSize;		/**< sizeof(MqsArchiveHeader_t). */
+	uint32_t pointSize;			/**< sizeof(MqsRawDataPoint_t). */
+	uint32_t alignment;			/**< Alignment of every payload, in bytes. */
+	uint64_t sweepCount;		/**< Number of index entries. */
+	uint64_t indexOffset;		/**< File offset of the index. */
+	uint8_t reserved[32];
+} MqsArchiveHeader_t;
+
+/*!
+ * @brief Index record describing one sweep.
+ */
+typedef struct {
+	uint64_t offset;			/**< File offset of the payload. */
+	uint32_t length;			/**< Number of MqsRawDataPoint_t in the payload. */
+	uint32_t reserved;
+	uint64_t sweepId;			/**< Caller-defined sweep identifier. */
+	int64_t timestamp;			/**< Caller-defined acquisition time stamp. */
+} MqsArchiveIndexEntry_t;
+
+/*!
+ * @brief Expected access pattern, forwarded to the kernel as an madvise hint.
+ */
+typedef enum {
+	MQS_ARCHIVE_NORMAL = 0,
+	MQS_ARCHIVE_SEQUENTIAL,
+	MQS_ARCHIVE_RANDOM
+} MqsArchiveAccess_t;
+
+/*!
+ * @brief Read-only view of an archive opened with sweepArchiveOpen.
+ */
+typedef struct {
+	uint8_t *base;						/**< Start of the mapping. */
+	size_t mappedSize;					/**< Size of the mapping in bytes. */
+	const MqsArchiveHeader_t *header;
+	const MqsArchiveIndexEntry_t *index;
+	bool mapped;						/**< False if the file was read into memory instead. */
+} MqsSweepArchive_t;
+
+/*!
+ * @brief Zero-copy view of one archived sweep.
+ */
+typedef struct {
+	MqsRawDataPoint_t *points;	/**< Payload inside the mapping, writable copy-on-write. */
+	int size;
+	uint64_t sweepId;
+	int64_t timestamp;
+} MqsSweepView_t;
+
+/*!
+ * @brief State of an archive being written.
+ */
+typedef struct {
+	FILE *file;
+	uint64_t offset;
+	MqsArchiveIndexEntry_t *index;
+	uint64_t count;
+	uint64_t capacity;
+} MqsSweepArchiveWriter_t;
+
+   /*******************************************************************************
+	* Functions
+	******************************************************************************/
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+	/**
+	 * @brief Maps an archive and validates its header and index.
+	 *
+	 * @param archive Pointer to the archive to initialise.
+	 * @param path Path of the archive file.
+	 * @param access Expected access pattern.
+	 * @return true if the archive is valid and mapped, false otherwise.
+	 */
+	bool sweepArchiveOpen(MqsSweepArchive_t *archive, const char *path, MqsArchiveAccess_t access);
+
+	/**
+	 * @brief Changes the access pattern hint of an open archive.
+	 *
+	 * @param archive Pointer to the open archive.
+	 * @param access Expected access pattern.
+	 */
+	void sweepArchiveAdvise(MqsSweepArchive_t *archive, MqsArchiveAccess_t access);
+
+	/**
+	 * @brief Returns the number of sweeps in an open archive.
+	 */
+	uint64_t sweepArchiveCount(const MqsSweepArchive_t *archive);
+
+	/**
+	 * @brief Returns a zero-copy view of one sweep.
+	 *
+	 * @param archive Pointer to the open archive.
+	 * @param n Position of the sweep in the index.
+	 * @param view Pointer to the view to fill.
+	 * @return true if n is a valid position, false otherwise.
+	 */
+	bool sweepArchiveGet(const MqsSweepArchive_t *archive, uint64_t n, MqsSweepView_t *view);
+
+	/**
+	 * @brief Unmaps an archive. Views obtained from it become invalid.
+	 */
+	void sweepArchiveClose(MqsSweepArchive_t *archive);
+
+	/**
+	 * @brief Creates a new archive, truncating any existing file.
+	 *
+	 * @param writer Pointer to the writer to initialise.
+	 * @param path Path of the archive file.
+	 * @return true on success, false otherwise.
+	 */
+	bool sweepArchiveCreate(MqsSweepArchiveWriter_t *writer, const char *path);
+
+	/**
+	 * @brief Appends one sweep to an archive being written.
+	 *
+	 * @param writer Pointer to the writer.
+	 * @param points The raw data array of the sweep.
+	 * @param size The size of the array.
+	 * @param sweepId Caller-defined sweep identifier.
+	 * @param timestamp Caller-defined acquisition time stamp.
+	 * @return true on success, false otherwise.
+	 */
+	bool sweepArchiveAppend(MqsSweepArchiveWriter_t *writer, const MqsRawDataPoint_t points[], int size, uint64_t sweepId, int64_t timestamp);
+
+	/**
+	 * @brief Writes the index, patches the header and closes the archive.
+	 *
+	 * @param writer Pointer to the writer.
+	 * @return true on success, false otherwise.
+	 */
+	bool sweepArchiveFinish(MqsSweepArchiveWriter_t *writer);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SWEEPARCHIVE_H */
@@ -0,0 +1,149 @@
+#ifndef SWEEPAVERAGE_H
+#define SWEEPAVERAGE_H
+
+/*******************************************************************************
+ * Includes
+ ******************************************************************************/
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "mes_peakfinder.h"
+#include "mes_workspace.h"
+
+  /*******************************************************************************
+   * Type definitions
+   ******************************************************************************/
+
+/*!
+ * @brief Estimate of each sweep point across the repeats.
+ *
+ * The robust modes apply to the phase angle, which the detector reads; the impedance is
+ * always the running mean.
+ */
+typedef enum {
+	MQS_AVERAGE_MEAN = 0,	/**< Running mean, no repeats are stored. */
+	MQS_AVERAGE_TRIMMED,	/**< Mean of the repeats left after dropping the extremes. */
+	MQS_AVERAGE_MEDIAN		/**< Median of the repeats. */
+} MqsAverageMode_t;
+
+/*!
+ * @brief When the averaged peak is considered stable enough to stop acquiring repeats.
+ */
+typedef struct {
+	int minSweeps;				/**< Repeats to accumulate before the first check. */
+	float prominenceTolerance;	/**< Largest relative change of the prominence between checks. */
+	float fwhmTolerance;		/**< Largest change of the interpolated FWHM between checks, in samples. */
+	int stableChecks;			/**< Consecutive checks within tolerance needed to stop. */
+} MqsAverageStopCriteria_t;
+
+/*!
+ * @brief Accumulator of repeated sweeps of the same length.
+ *
+ * The phase angle of every point has a running mean and a Welford sum of squared deviations,
+ * so the variance is available at any time. The robust modes also keep the phase of every
+ * repeat, up to the capacity given at initialisation. All tables live in a workspace.
+ */
+typedef struct {
+	int size;				/**< Points per sweep. */
+	int count;				/**< Repeats accumulated so far. */
+	int capacity;			/**< Repeats that can be stored for the robust modes. */
+	MqsAverageMode_t mode;
+	float trimFraction;		/**< Fraction of the repeats dropped at each end by MQS_AVERAGE_TRIMMED. */
+	float *mean;			/**< Running mean of the phase angle. */
+	float *m2;				/**< Sum of squared deviations of the phase angle from the mean. */
+	float *impedance;		/**< Running mean of the impedance. */
+	float *history;			/**< Phase angle of each repeat, point-major, robust modes only. */
+	float *scratch;			/**< Sort buffer of one point, robust modes only. */
+	float lastProminence;	/**< Prominence at the previous stability check. */
+	float lastFwhm;			/**< Interpolated FWHM at the previous stability check. */
+	int stableCount;		/**< Consecutive checks within tolerance. */
+} MqsSweepAverage_t;
+
+   /*******************************************************************************
+	* Functions
+	******************************************************************************/
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+	/**
+	 * @brief Returns the workspace size needed by sweepAverageInit.
+	 *
+	 * @param size The number of points per sweep.
+	 * @param mode The estimate that will be used.
+	 * @param maxRepeats The largest number of repeats, only used by the robust modes.
+	 * @return The number of workspace bytes.
+	 */
+	size_t sweepAverageWorkspaceSize(int size, MqsAverageMode_t mode, int maxRepeats);
+
+	/**
+	 * @brief Sets up an accumulator in the workspace.
+	 *
+	 * The tables stay allocated until the caller releases the workspace.
+	 *
+	 * @param average Pointer to the accumulator.
+	 * @param size The number of points per sweep.
+	 * @param mode The estimate of each point.
+	 * @param trimFraction Fraction of the repeats dropped at each end in MQS_AVERAGE_TRIMMED mode.
+	 * @param maxRepeats The largest number of repeats, only used by the robust modes.
+	 * @param workspace Scratch memory of at least sweepAverageWorkspaceSize bytes.
+	 * @return False if the workspace is too small.
+	 */
+	bool sweepAverageInit(MqsSweepAverage_t *average, int size, MqsAverageMode_t mode, float trimFraction, int maxRepeats, MqsWorkspace_t *workspace);
+
+	/**
+	 * @brief Adds one repeat.
+	 *
+	 * @param average Pointer to the accumulator.
+	 * @param sweep The repeat, of the accumulator's size.
+	 * @return False if the robust modes have no room left for the repeat.
+	 */
+	bool sweepAverageAdd(MqsSweepAverage_t *average, const MqsRawDataPoint_t sweep[]);
+
+	/**
+	 * @brief Writes the current estimate of every point.
+	 *
+	 * @param average Pointer to the accumulator.
+	 * @param sweep Output, the averaged sweep.
+	 */
+	void sweepAverageEstimate(MqsSweepAverage_t *average, MqsRawDataPoint_t sweep[]);
+
+	/**
+	 * @brief Writes the sample variance of the phase angle of every point.
+	 *
+	 * @param average Pointer to the accumulator.
+	 * @param variance Output, one value per point, 0 until two repeats are accumulated.
+	 */
+	void sweepAverageVariance(const MqsSweepAverage_t *average, float variance[]);
+
+	/**
+	 * @brief Returns the workspace size needed by sweepAverageIsStable.
+	 *
+	 * @param size The number of points per sweep.
+	 * @param config The configuration that will be used, or NULL for the defaults.
+	 * @return The number of workspace bytes.
+	 */
+	size_t sweepAverageIsStableWorkspaceSize(int size, const MqsPeakConfig_t *config);
+
+	/**
+	 * @brief Checks whether the peak of the current estimate has stopped changing.
+	 *
+	 * Runs processPeakDetailed on the estimate and compares the prominence and the
+	 * interpolated FWHM with the previous check.
+	 *
+	 * @param average Pointer to the accumulator.
+	 * @param criteria The stopping criteria.
+	 * @param config Options of processPeakDetailed, or NULL for the defaults.
+	 * @param workspace Scratch memory of at least sweepAverageIsStableWorkspaceSize bytes,
+	 *                  released on return.
+	 * @return True once the peak has been accepted and stable for the required checks.
+	 */
+	bool sweepAverageIsStable(MqsSweepAverage_t *average, const MqsAverageStopCriteria_t *criteria,
+							  const MqsPeakConfig_t *config, MqsWorkspace_t *workspace);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SWEEPAVERAGE_H */
@@ -0,0 +1,88 @@
+#ifndef WORKSPACE_H
+#define WORKSPACE_H
+
+/*******************************************************************************
+ * Includes
+ ******************************************************************************/
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+ /*******************************************************************************
+  * Defines
+  ******************************************************************************/
+
+/*!
+ * @brief Alignment of every block handed out by workspaceAlloc, in bytes.
+ */
+#define WORKSPACE_ALIGNMENT 64
+
+/*!
+ * @brief Workspace bytes needed for an array of count elements of the given type.
+ *
+ * Every *WorkspaceSize query adds up one term per workspaceAlloc call of its entry point, the
+ * queries of the entry points it hands the workspace on to, and one WORKSPACE_ALIGNMENT for
+ * the padding of a buffer that is not aligned, so its result suits any buffer on its own.
+ * Queries return 0 when the entry point needs no workspace.
+ */
+#define WORKSPACE_BYTES(count, type) \
+	((((size_t)(count) * sizeof(type)) + WORKSPACE_ALIGNMENT - 1) / WORKSPACE_ALIGNMENT * WORKSPACE_ALIGNMENT)
+
+  /*******************************************************************************
+   * Type definitions
+   ******************************************************************************/
+
+/*!
+ * @brief Bump arena over a caller-owned buffer.
+ *
+ * Entry points that need scratch memory take a workspace instead of calling malloc. They
+ * carve their tables out of it with workspaceAlloc and release them on return, so the same
+ * workspace can be reused for every sweep without touching the heap.
+ */
+typedef struct {
+	uint8_t *base;
+	size_t capacity;
+	size_t used;
+} MqsWorkspace_t;
+
+   /*******************************************************************************
+	* Functions
+	******************************************************************************/
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+	/**
+	 * @brief Initialises a workspace over a caller-owned buffer.
+	 *
+	 * @param workspace Pointer to the workspace.
+	 * @param buffer The buffer, ideally aligned to WORKSPACE_ALIGNMENT.
+	 * @param capacity The size of the buffer in bytes.
+	 */
+	void workspaceInit(MqsWorkspace_t *workspace, void *buffer, size_t capacity);
+
+	/**
+	 * @brief Carves an aligned block out of the workspace.
+	 *
+	 * @param workspace Pointer to the workspace, may be NULL.
+	 * @param bytes The size of the block.
+	 * @return The block, or NULL if the workspace is NULL or exhausted.
+	 */
+	void *workspaceAlloc(MqsWorkspace_t *workspace, size_t bytes);
+
+	/**
+	 * @brief Returns the current fill level, to be passed to workspaceRelease.
+	 */
+	size_t workspaceMark(const MqsWorkspace_t *workspace);
+
+	/**
+	 * @brief Releases every block allocated since the given mark.
+	 */
+	void workspaceRelease(MqsWorkspace_t *workspace, size_t mark);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* WORKSPACE_H */
@@ -0,0 +1,190 @@
+/*!
+ * Noise Floor Estimation
+ *
+ * Description:
+ * Estimates the noise of a sweep from the median absolute deviation of its first
+ * differences, in O(n) with an introselect over a workspace copy. The per-channel estimate
+ * lets the detector express its prominence and edge tolerances in units of the noise, so
+ * the same configuration holds on channels whose noise differs by an order of magnitude.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+#include <stdbool.h>
+#include "mes_noise.h"
+#include "mes_workspace.h"
+#include "mes_noalloc.h"
+
+/*!
+ * @brief Restores the max-heap property below node i of a heap rooted at base.
+ */
+static void siftDownValues(float values[], int base, int count, int i)
+{
+    for (;;)
+    {
+        int child = 2 * i + 1;
+        if (child >= count)
+        {
+            return;
+        }
+        if (child + 1 < count && values[base + child + 1] > values[base + child])
+        {
+            child++;
+        }
+        if (values[base + i] >= values[base + child])
+        {
+            return;
+        }
+        float tmp = values[base + i];
+        values[base + i] = values[base + child];
+        values[base + child] = tmp;
+        i = child;
+    }
+}
+
+/*!
+ * @brief Returns the k-th smallest of values[lo .. hi] by heapselect, O(n log n).
+ *
+ * A max-heap of the k - lo + 1 smallest values so far is kept at the start of the range.
+ */
+static float heapselect(float values[], int lo, int hi, int k)
+{
+    int count = k - lo + 1;
+
+    for (int i = count / 2 - 1; i >= 0; i--)
+    {
+        siftDownValues(values, lo, count, i);
+    }
+    for (int i = lo + count; i <= hi; i++)
+    {
+        if (values[i] < values[lo])
+        {
+            float tmp = values[i];
+            values[i] = values[lo];
+            values[lo] = tmp;
+            siftDownValues(values, lo, count, 0);
+        }
+    }
+    return values[lo];
+}
+
+/*!
+ * @brief Returns the median of three values.
+ */
+static inline float medianOfThree(float x, float y, float z)
+{
+    return fmaxf(fminf(x, y), fminf(fmaxf(x, y), z));
+}
+
+float introselect(float values[], int count, int k)
+{
+    int lo = 0;
+    int hi = count - 1;
+    int budget = 0;
+
+    // Twice the depth of a balanced partitioning before switching to heapselect
+    for (int n = count; n > 1; n >>= 1)
+    {
+        budget += 2;
+    }
+
+    while (lo < hi)
+    {
+        if (budget-- == 0)
+        {
+            return heapselect(values, lo, hi, k);
+        }
+
+        float pivot = medianOfThree(values[lo], values[lo + (hi - lo) / 2], values[hi]);
+        int i = lo;
+        int j = hi;
+        while (i <= j)
+        {
+            while (values[i] < pivot) i++;
+            while (values[j] > pivot) j--;
+            if (i <= j)
+            {
+                float tmp = values[i];
+                values[i] = values[j];
+                values[j] = tmp;
+                i++;
+                j--;
+            }
+        }
+
+        // values[lo .. j] <= pivot <= values[i .. hi], everything in between equals the pivot
+        if (k <= j)
+        {
+            hi = j;
+        }
+        else if (k >= i)
+        {
+            lo = i;
+        }
+        else
+        {
+            return values[k];
+        }
+    }
+    return values[k];
+}
+
+size_t noiseWorkspaceSize(int size)
+{
+    return WORKSPACE_BYTES(size, float) + WORKSPACE_ALIGNMENT;
+}
+
+float estimateNoise(const MqsRawDataPoint_t a[], int size, MqsWorkspace_t *workspace)
+{
+    if (size < 2)
+    {
+        return -1.0f;
+    }
+
+    size_t mark = workspaceMark(workspace);
+    int count = size - 1;
+    float *differences = workspaceAlloc(workspace, (size_t)count * sizeof(float));
+    if (differences == NULL)
+    {
+        return -1.0f;
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+        differences[i] = a[i + 1].phaseAngle - a[i].phaseAngle;
+    }
+    float median = introselect(differences, count, count / 2);
+
+    for (int i = 0; i < count; i++)
+    {
+        differences[i] = fabsf(differences[i] - median);
+    }
+    float mad = introselect(differences, count, count / 2);
+
+    workspaceRelease(workspace, mark);
+    return mad * NOISE_DIFFERENCE_MAD_SCALE;
+}
+
+void noiseInit(MqsNoiseEstimate_t *noise)
+{
+    *noise = (MqsNoiseEstimate_t){ 0 };
+}
+
+bool noiseUpdate(MqsNoiseEstimate_t *noise, const MqsRawDataPoint_t a[], int size, MqsWorkspace_t *workspace)
+{
+    float sigma = estimateNoise(a, size, workspace);
+    if (sigma < 0.0f)
+    {
+        return false;
+    }
+
+    // Equal weights until the exponential weight takes over
+    float weight = 1.0f / (float)(noise->sweeps + 1);
+    weight = (weight < NOISE_UPDATE_WEIGHT) ? NOISE_UPDATE_WEIGHT : weight;
+
+    noise->sigma += (sigma - noise->sigma) * weight;
+    noise->sweeps++;
+    return true;
+}
@@ -0,0 +1,316 @@
+/*!
+ * Persistence-Based Peak Hierarchy
+ *
+ * Description:
+ * Builds the merge tree of the superlevel sets of a sweep. Samples are visited from the
+ * highest to the lowest; each sample either starts a new region (a peak is born), extends
+ * the region of a neighbour, or joins two regions. When two regions join, the one with the
+ * lower peak dies at that sample, which is its saddle. The difference between birth and
+ * death is the peak's persistence, i.e. its topographic prominence.
+ *
+ * The detector's prominence, down to the lower base between the nearest higher samples, is
+ * found for every sample by two monotonic stack passes and stored next to the persistence.
+ *
+ * The peaks are stored sorted by decreasing persistence, so selecting all peaks above any
+ * prominence threshold is a prefix of the table and needs no recomputation.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "mes_persistence.h"
+#include "mes_workspace.h"
+#include "mes_noalloc.h"
+
+/*!
+ * @brief Sample value and index, sorted together.
+ */
+typedef struct {
+    float value;
+    int index;
+} SortKey_t;
+
+/*!
+ * @brief Returns true if key x comes before key y: higher values first, ties by index.
+ */
+static inline bool keyBefore(SortKey_t x, SortKey_t y)
+{
+    return x.value > y.value || (x.value == y.value && x.index < y.index);
+}
+
+/*!
+ * @brief Restores the heap property below node i, with the last key in order at the root.
+ */
+static void siftDownKeys(SortKey_t keys[], int count, int i)
+{
+    for (;;)
+    {
+        int child = 2 * i + 1;
+        if (child >= count)
+        {
+            return;
+        }
+        if (child + 1 < count && !keyBefore(keys[child + 1], keys[child]))
+        {
+            child++;
+        }
+        if (!keyBefore(keys[i], keys[child]))
+        {
+            return;
+        }
+        SortKey_t tmp = keys[i];
+        keys[i] = keys[child];
+        keys[child] = tmp;
+        i = child;
+    }
+}
+
+/*!
+ * @brief Sorts the keys in place with heapsort, which needs no extra memory.
+ */
+static void sortKeys(SortKey_t keys[], int count)
+{
+    for (int i = count / 2 - 1; i >= 0; i--)
+    {
+        siftDownKeys(keys, count, i);
+    }
+    for (int end = count - 1; end > 0; end--)
+    {
+        SortKey_t tmp = keys[0];
+        keys[0] = keys[end];
+        keys[end] = tmp;
+        siftDownKeys(keys, end, 0);
+    }
+}
+
+/*!
+ * @brief Restores the heap property below node i, with the most persistent peak last.
+ */
+static void siftDownPeaks(MqsPersistencePeak_t peaks[], int count, int i)
+{
+    for (;;)
+    {
+        int child = 2 * i + 1;
+        if (child >= count)
+        {
+            return;
+        }
+        if (child + 1 < count && peaks[child + 1].persistence < peaks[child].persistence)
+        {
+            child++;
+        }
+        if (peaks[i].persistence <= peaks[child].persistence)
+        {
+            return;
+        }
+        MqsPersistencePeak_t tmp = peaks[i];
+        peaks[i] = peaks[child];
+        peaks[child] = tmp;
+        i = child;
+    }
+}
+
+/*!
+ * @brief Sorts the peaks by decreasing persistence in place.
+ */
+static void sortPeaks(MqsPersistencePeak_t peaks[], int count)
+{
+    for (int i = count / 2 - 1; i >= 0; i--)
+    {
+        siftDownPeaks(peaks, count, i);
+    }
+    for (int end = count - 1; end > 0; end--)
+    {
+        MqsPersistencePeak_t tmp = peaks[0];
+        peaks[0] = peaks[end];
+        peaks[end] = tmp;
+        siftDownPeaks(peaks, end, 0);
+    }
+}
+
+/*!
+ * @brief Returns the root of the region of sample i, halving the path on the way.
+ */
+static int findRoot(int parent[], int i)
+{
+    while (parent[i] != i)
+    {
+        parent[i] = parent[parent[i]];
+        i = parent[i];
+    }
+    return i;
+}
+
+/*!
+ * @brief Finds for every sample the lowest sample between the nearest higher samples on either side.
+ *
+ * This is the base findProminence subtracts. A stack of samples in decreasing order holds,
+ * for each entry, the minimum of the samples it covers, so samples that are not higher are
+ * merged into the next entry in amortised O(1). The sorted keys are reused as the stack.
+ *
+ * @param a The raw data array.
+ * @param size The size of the array.
+ * @param stack Scratch of size entries.
+ * @param base Output, the lower base of every sample.
+ */
+static void findLowerBases(const MqsRawDataPoint_t a[], int size, SortKey_t stack[], float base[])
+{
+    int depth = 0;
+
+    // Lowest sample from the nearest higher one on the left, or the start
+    for (int i = 0; i < size; i++)
+    {
+        float lowest = a[i].phaseAngle;
+        while (depth > 0 && a[stack[depth - 1].index].phaseAngle <= a[i].phaseAngle)
+        {
+            lowest = (stack[depth - 1].value < lowest) ? stack[depth - 1].value : lowest;
+            depth--;
+        }
+        base[i] = lowest;
+        stack[depth].value = lowest;
+        stack[depth].index = i;
+        depth++;
+    }
+
+    // The same on the right; the lower of both sides is the base
+    depth = 0;
+    for (int i = size - 1; i >= 0; i--)
+    {
+        float lowest = a[i].phaseAngle;
+        while (depth > 0 && a[stack[depth - 1].index].phaseAngle <= a[i].phaseAngle)
+        {
+            lowest = (stack[depth - 1].value < lowest) ? stack[depth - 1].value : lowest;
+            depth--;
+        }
+        base[i] = (lowest < base[i]) ? lowest : base[i];
+        stack[depth].value = lowest;
+        stack[depth].index = i;
+        depth++;
+    }
+}
+
+size_t persistenceWorkspaceSize(int size)
+{
+    return WORKSPACE_BYTES(size, SortKey_t) + 2 * WORKSPACE_BYTES(size, int) + WORKSPACE_BYTES(size, float) + WORKSPACE_ALIGNMENT;
+}
+
+int buildPersistence(MqsRawDataPoint_t a[], int size, MqsWorkspace_t *workspace, MqsPersistencePeak_t peaks[], int capacity)
+{
+    if (size <= 0)
+    {
+        return 0;
+    }
+
+    size_t mark = workspaceMark(workspace);
+    SortKey_t *keys = workspaceAlloc(workspace, (size_t)size * sizeof(SortKey_t));
+    int *parent = workspaceAlloc(workspace, (size_t)size * sizeof(int));
+    int *regionPeak = workspaceAlloc(workspace, (size_t)size * sizeof(int)); // Highest sample, valid at roots
+    float *base = workspaceAlloc(workspace, (size_t)size * sizeof(float));
+    int count = 0;
+
+    if (keys == NULL || parent == NULL || regionPeak == NULL || base == NULL)
+    {
+        workspaceRelease(workspace, mark);
+        return -1;
+    }
+
+    for (int i = 0; i < size; i++)
+    {
+        keys[i].value = a[i].phaseAngle;
+        keys[i].index = i;
+        parent[i] = -1; // Not yet part of any region
+    }
+    sortKeys(keys, size);
+
+    for (int k = 0; k < size; k++)
+    {
+        int i = keys[k].index;
+        int left = (i > 0 && parent[i - 1] >= 0) ? findRoot(parent, i - 1) : -1;
+        int right = (i < size - 1 && parent[i + 1] >= 0) ? findRoot(parent, i + 1) : -1;
+
+        if (left < 0 && right < 0)
+        {
+            // A new peak is born
+            parent[i] = i;
+            regionPeak[i] = i;
+        }
+        else if (left < 0 || right < 0)
+        {
+            // Extend the single neighbouring region
+            parent[i] = (left >= 0) ? left : right;
+        }
+        else
+        {
+            // Two regions meet at this saddle; the lower peak dies here
+            int leftPeak = regionPeak[left];
+            int rightPeak = regionPeak[right];
+            SortKey_t leftKey = { a[leftPeak].phaseAngle, leftPeak };
+            SortKey_t rightKey = { a[rightPeak].phaseAngle, rightPeak };
+            int survivor = keyBefore(leftKey, rightKey) ? left : right;
+            int dying = (survivor == left) ? right : left;
+
+            if (count >= capacity)
+            {
+                workspaceRelease(workspace, mark);
+                return -1;
+            }
+            peaks[count].peakIndex = regionPeak[dying];
+            peaks[count].saddleIndex = i;
+            peaks[count].birth = a[regionPeak[dying]].phaseAngle;
+            peaks[count].death = a[i].phaseAngle;
+            peaks[count].persistence = peaks[count].birth - peaks[count].death;
+            count++;
+
+            parent[dying] = survivor;
+            parent[i] = survivor;
+        }
+    }
+
+    // The highest peak survives every merge and dies at the global minimum
+    if (count >= capacity)
+    {
+        workspaceRelease(workspace, mark);
+        return -1;
+    }
+    int top = keys[0].index;
+    int bottom = keys[size - 1].index;
+    peaks[count].peakIndex = top;
+    peaks[count].saddleIndex = bottom;
+    peaks[count].birth = a[top].phaseAngle;
+    peaks[count].death = a[bottom].phaseAngle;
+    peaks[count].persistence = peaks[count].birth - peaks[count].death;
+    count++;
+
+    findLowerBases(a, size, keys, base);
+    for (int p = 0; p < count; p++)
+    {
+        peaks[p].prominence = peaks[p].birth - base[peaks[p].peakIndex];
+    }
+
+    sortPeaks(peaks, count);
+
+    workspaceRelease(workspace, mark);
+    return count;
+}
+
+int queryPersistence(const MqsPersistencePeak_t peaks[], int count, float minPersistence)
+{
+    int lo = 0;
+    int hi = count;
+
+    // First entry whose persistence does not exceed the threshold
+    while (lo < hi)
+    {
+        int mid = lo + (hi - lo) / 2;
+        if (peaks[mid].persistence > minPersistence)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+    return lo;
+}
@@ -0,0 +1,92 @@
+/*!
+ * Phase Unwrapping
+ *
+ * Description:
+ * Removes the jumps of front ends that report the phase angle wrapped to one period, in
+ * place and one segment at a time.
+ *
+ * The segment is processed in blocks of UNWRAP_BLOCK samples. The number of periods jumped
+ * between two samples depends on the raw samples only, so a first pass computes every
+ * count of the block lane-parallel; a running integer sum turns them into the multiple of
+ * the period owed by each sample, and a last pass adds the offsets. Only the integer sum
+ * is serial, instead of the float offset carried through every sample.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+#include <stdbool.h>
+#include "mes_phaseunwrap.h"
+#include "mes_noalloc.h"
+
+/*!
+ * @brief Samples per block; the wrap counts of a block are kept on the stack.
+ */
+#define UNWRAP_BLOCK 256
+
+void phaseUnwrapInit(MqsPhaseUnwrap_t *state, float period)
+{
+    state->period = period;
+    state->offset = 0.0f;
+    state->previous = 0.0f;
+    state->started = false;
+}
+
+/*!
+ * @brief Returns the nearest whole number of periods in a jump, floor(x + 0.5).
+ *
+ * Built from a truncating conversion so it vectorises without a rounding instruction;
+ * valid while the jump is below 2^31 periods.
+ */
+static inline int wrapCount(float jump, float period)
+{
+    float y = jump / period + 0.5f;
+    int t = (int)y;
+    return t - (y < (float)t);
+}
+
+void phaseUnwrap(MqsPhaseUnwrap_t *state, MqsRawDataPoint_t a[], int size)
+{
+    if (size <= 0)
+    {
+        return;
+    }
+
+    float period = state->period;
+    float offset = state->offset;
+    float previous = state->started ? state->previous : a[0].phaseAngle;
+    int wraps[UNWRAP_BLOCK];
+
+    for (int start = 0; start < size; start += UNWRAP_BLOCK)
+    {
+        MqsRawDataPoint_t *block = &a[start];
+        int count = (size - start < UNWRAP_BLOCK) ? size - start : UNWRAP_BLOCK;
+
+        // Wrap counts depend on two raw samples only, so this pass runs lane-parallel
+        wraps[0] = wrapCount(block[0].phaseAngle - previous, period);
+        for (int k = 1; k < count; k++)
+        {
+            wraps[k] = wrapCount(block[k].phaseAngle - block[k - 1].phaseAngle, period);
+        }
+        previous = block[count - 1].phaseAngle;
+
+        // Running total of the wraps; integer adds, the only serial step
+        int total = 0;
+        for (int k = 0; k < count; k++)
+        {
+            total += wraps[k];
+            wraps[k] = total;
+        }
+
+        for (int k = 0; k < count; k++)
+        {
+            block[k].phaseAngle += offset - period * (float)wraps[k];
+        }
+        offset -= period * (float)total;
+    }
+
+    state->offset = offset;
+    state->previous = previous;
+    state->started = true;
+}
@@ -0,0 +1,210 @@
+/*!
+ * Resonance / Anti-Resonance Detection
+ *
+ * Description:
+ * Finds the minima (resonances) and maxima (anti-resonances) of the impedance of a sweep in
+ * one scan, without negating the data, and pairs them to derive the effective coupling
+ * coefficient of piezoelectric and MEMS resonators, and locates the zero crossings of the
+ * phase angle, where many devices are operated.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "mes_resonance.h"
+#include "mes_phasescan.h"
+#include "mes_noalloc.h"
+
+/*!
+ * @brief Appends an extremum and completes the prominence of the previous one.
+ *
+ * The left side of a new extremum is the previous extremum, and the previous extremum's
+ * right side is the new one, so both are known at this point.
+ *
+ * @return False if the table is full.
+ */
+static bool appendExtremum(MqsExtremum_t extrema[], int *count, int capacity, MqsIndex_t index, float value, bool isPeak, float leftSide)
+{
+    if (*count >= capacity)
+    {
+        return false;
+    }
+
+    float leftDrop = isPeak ? value - leftSide : leftSide - value;
+    if (*count > 0)
+    {
+        MqsExtremum_t *previous = &extrema[*count - 1];
+        float rightDrop = previous->isPeak ? previous->value - value : value - previous->value;
+        previous->prominence = (rightDrop < previous->prominence) ? rightDrop : previous->prominence;
+    }
+
+    extrema[*count].index = index;
+    extrema[*count].value = value;
+    extrema[*count].prominence = leftDrop; // Completed by the next extremum or at the end
+    extrema[*count].isPeak = isPeak;
+    (*count)++;
+    return true;
+}
+
+int findImpedanceExtrema(MqsRawDataPoint_t a[], int size, float minProminence, MqsExtremum_t extrema[], int capacity)
+{
+    if (size <= 0)
+    {
+        return 0;
+    }
+#ifdef MES_INDEX_16BIT
+    // The indices of longer sweeps would not fit the result
+    if (size - 1 > MES_INDEX_MAX)
+    {
+        printf("Sweep too long for 16-bit indices.\n");
+        return 0;
+    }
+#endif
+
+    float maxValue = a[0].impedance;
+    float minValue = a[0].impedance;
+    int maxIndex = 0;
+    int minIndex = 0;
+    float minBeforeMax = a[0].impedance; // Lowest sample between the last extremum and maxIndex
+    float maxBeforeMin = a[0].impedance; // Highest sample between the last extremum and minIndex
+    int direction = 0;                   // 1 looking for a maximum, -1 for a minimum, 0 not yet known
+    int count = 0;
+
+    for (int i = 1; i < size; i++)
+    {
+        float value = a[i].impedance;
+
+        if (value > maxValue)
+        {
+            maxValue = value;
+            maxIndex = i;
+            minBeforeMax = minValue;
+        }
+        if (value < minValue)
+        {
+            minValue = value;
+            minIndex = i;
+            maxBeforeMin = maxValue;
+        }
+
+        if (direction >= 0 && value < maxValue - minProminence)
+        {
+            // The impedance fell far enough below the running maximum to confirm it; a
+            // maximum on the first sample is only the edge of the sweep
+            float leftSide = (count > 0) ? extrema[count - 1].value : minBeforeMax;
+            if (maxIndex > 0 && !appendExtremum(extrema, &count, capacity, maxIndex, maxValue, true, leftSide))
+            {
+                return -1;
+            }
+            direction = -1;
+            maxBeforeMin = (count > 0) ? value : maxValue;
+            minValue = value;
+            minIndex = i;
+            maxValue = value;
+            maxIndex = i;
+        }
+        else if (direction <= 0 && value > minValue + minProminence)
+        {
+            // The impedance rose far enough above the running minimum to confirm it
+            float leftSide = (count > 0) ? extrema[count - 1].value : maxBeforeMin;
+            if (minIndex > 0 && !appendExtremum(extrema, &count, capacity, minIndex, minValue, false, leftSide))
+            {
+                return -1;
+            }
+            direction = 1;
+            minBeforeMax = (count > 0) ? value : minValue;
+            maxValue = value;
+            maxIndex = i;
+            minValue = value;
+            minIndex = i;
+        }
+    }
+
+    // The right side of the last extremum is the most extreme sample after it
+    if (count > 0)
+    {
+        MqsExtremum_t *last = &extrema[count - 1];
+        float rightDrop = last->isPeak ? last->value - minValue : maxValue - last->value;
+        last->prominence = (rightDrop < last->prominence) ? rightDrop : last->prominence;
+    }
+    return count;
+}
+
+int pairResonances(const MqsExtremum_t extrema[], int count, float startFrequency, float frequencyStep, MqsResonancePair_t pairs[], int capacity)
+{
+    int numPairs = 0;
+
+    for (int k = 0; k + 1 < count && numPairs < capacity; k++)
+    {
+        if (extrema[k].isPeak || !extrema[k + 1].isPeak)
+        {
+            continue;
+        }
+
+        float fr = startFrequency + (float)extrema[k].index * frequencyStep;
+        float fa = startFrequency + (float)extrema[k + 1].index * frequencyStep;
+
+        pairs[numPairs].resonanceIndex = extrema[k].index;
+        pairs[numPairs].antiResonanceIndex = extrema[k + 1].index;
+        pairs[numPairs].resonanceFrequency = fr;
+        pairs[numPairs].antiResonanceFrequency = fa;
+        pairs[numPairs].couplingSquared = (fa != 0.0f) ? (fa * fa - fr * fr) / (fa * fa) : 0.0f;
+        numPairs++;
+    }
+    return numPairs;
+}
+
+int findZeroCrossings(MqsRawDataPoint_t a[], int size, float hysteresis, MqsZeroCrossing_t crossings[], int capacity)
+{
+#ifdef MES_INDEX_16BIT
+    // The indices of longer sweeps would not fit the result
+    if (size - 1 > MES_INDEX_MAX)
+    {
+        printf("Sweep too long for 16-bit indices.\n");
+        return 0;
+    }
+#endif
+
+    int count = 0;
+
+    // The first sample outside the band sets the initial sign
+    int above = scanPhaseRight(a, 0, size - 1, hysteresis, PHASE_ABOVE);
+    int below = scanPhaseRight(a, 0, size - 1, -hysteresis, PHASE_BELOW);
+    if (above < 0 || below < 0)
+    {
+        return 0;
+    }
+    bool positive = above < below;
+    int i = positive ? above : below;
+
+    while (count < capacity)
+    {
+        // Leave the band on the other side
+        int trigger = positive ? scanPhaseRight(a, i, size - 1, -hysteresis, PHASE_BELOW)
+                               : scanPhaseRight(a, i, size - 1, hysteresis, PHASE_ABOVE);
+        if (trigger < 0)
+        {
+            break;
+        }
+
+        // The crossing is the last sign change before the trigger
+        int j = trigger - 1;
+        while (positive ? a[j].phaseAngle < 0.0f : a[j].phaseAngle > 0.0f)
+        {
+            j--;
+        }
+
+        float y0 = a[j].phaseAngle;
+        float y1 = a[j + 1].phaseAngle;
+        crossings[count].index = (MqsIndex_t)j;
+        crossings[count].position = (float)j + ((y0 != y1) ? y0 / (y0 - y1) : 0.0f);
+        crossings[count].slope = y1 - y0;
+        crossings[count].rising = !positive;
+        count++;
+
+        positive = !positive;
+        i = trigger;
+    }
+    return count;
+}
@@ -0,0 +1,330 @@
+/*!
+ * Binary Sweep Archive
+ *
+ * Description:
+ * Reader and writer for the binary sweep archive described in mes_sweeparchive.h. The
+ * reader memory-maps the file so archived sweeps can be handed to processPeak and the
+ * other detectors without parsing or copying. The mapping is private and writable, so
+ * detectors that work in place only modify their own copy-on-write pages.
+ */
+
+#if !defined(_POSIX_C_SOURCE) && !defined(_WIN32)
+#define _POSIX_C_SOURCE 200112L
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+#include "mes_sweeparchive.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define SWEEP_ARCHIVE_MMAP 1
+#else
+#define SWEEP_ARCHIVE_MMAP 0
+#endif
+
+// The on-disk layout depends on these sizes
+typedef char headerSizeCheck[(sizeof(MqsArchiveHeader_t) == 64) ? 1 : -1];
+typedef char indexEntrySizeCheck[(sizeof(MqsArchiveIndexEntry_t) == 32) ? 1 : -1];
+
+/*!
+ * @brief Returns true if the host stores integers little-endian, as the archive does.
+ */
+static bool isLittleEndian(void)
+{
+    const uint16_t probe = 1;
+    return *(const uint8_t *)&probe == 1;
+}
+
+/*!
+ * @brief Checks the header and every index entry against the size of the file.
+ *
+ * @param archive The archive whose base and mappedSize are set.
+ * @return true if all payloads and the index lie within the file, false otherwise.
+ */
+static bool validateArchive(MqsSweepArchive_t *archive)
+{
+    if (archive->mappedSize < sizeof(MqsArchiveHeader_t))
+    {
+        printf("Sweep archive too small.\n");
+        return false;
+    }
+
+    const MqsArchiveHeader_t *header = (const MqsArchiveHeader_t *)archive->base;
+    if (header->magic != SWEEP_ARCHIVE_MAGIC || header->version != SWEEP_ARCHIVE_VERSION ||
+        header->headerSize != sizeof(MqsArchiveHeader_t) || header->pointSize != sizeof(MqsRawDataPoint_t))
+    {
+        printf("Invalid sweep archive header.\n");
+        return false;
+    }
+
+    // Divide rather than multiply, a crafted sweep count must not wrap the index size
+    if (header->indexOffset > archive->mappedSize ||
+        header->sweepCount > (archive->mappedSize - header->indexOffset) / sizeof(MqsArchiveIndexEntry_t) ||
+        header->indexOffset % sizeof(uint64_t) != 0)
+    {
+        printf("Sweep archive index out of range.\n");
+        return false;
+    }
+
+    const MqsArchiveIndexEntry_t *index = (const MqsArchiveIndexEntry_t *)(archive->base + header->indexOffset);
+    for (uint64_t n = 0; n < header->sweepCount; n++)
+    {
+        uint64_t bytes = (uint64_t)index[n].length * sizeof(MqsRawDataPoint_t);
+        if (index[n].offset > archive->mappedSize || bytes > archive->mappedSize - index[n].offset ||
+            index[n].offset % sizeof(float) != 0 || index[n].length > INT32_MAX)
+        {
+            printf("Sweep archive entry %llu out of range.\n", (unsigned long long)n);
+            return false;
+        }
+    }
+
+    archive->header = header;
+    archive->index = index;
+    return true;
+}
+
+bool sweepArchiveOpen(MqsSweepArchive_t *archive, const char *path, MqsArchiveAccess_t access)
+{
+    memset(archive, 0, sizeof(*archive));
+
+    if (!isLittleEndian())
+    {
+        printf("Sweep archives require a little-endian host.\n");
+        return false;
+    }
+
+#if SWEEP_ARCHIVE_MMAP
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0)
+    {
+        close(fd);
+        return false;
+    }
+
+    void *base = mmap(NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED)
+    {
+        return false;
+    }
+
+    archive->base = base;
+    archive->mappedSize = (size_t)st.st_size;
+    archive->mapped = true;
+#else
+    FILE *file = fopen(path, "rb");
+    if (file == NULL)
+    {
+        return false;
+    }
+
+    fseek(file, 0, SEEK_END);
+    long length = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    archive->base = (length > 0) ? malloc((size_t)length) : NULL;
+    if (archive->base == NULL || fread(archive->base, 1, (size_t)length, file) != (size_t)length)
+    {
+        free(archive->base);
+        fclose(file);
+        archive->base = NULL;
+        return false;
+    }
+    fclose(file);
+    archive->mappedSize = (size_t)length;
+    archive->mapped = false;
+#endif
+
+    if (!validateArchive(archive))
+    {
+        sweepArchiveClose(archive);
+        return false;
+    }
+
+    sweepArchiveAdvise(archive, access);
+    return true;
+}
+
+void sweepArchiveAdvise(MqsSweepArchive_t *archive, MqsArchiveAccess_t access)
+{
+#if SWEEP_ARCHIVE_MMAP
+    if (!archive->mapped)
+    {
+        return;
+    }
+
+    int advice = POSIX_MADV_NORMAL;
+    if (access == MQS_ARCHIVE_SEQUENTIAL)
+    {
+        advice = POSIX_MADV_SEQUENTIAL;
+    }
+    else if (access == MQS_ARCHIVE_RANDOM)
+    {
+        advice = POSIX_MADV_RANDOM;
+    }
+    posix_madvise(archive->base, archive->mappedSize, advice);
+#else
+    (void)archive;
+    (void)access;
+#endif
+}
+
+uint64_t sweepArchiveCount(const MqsSweepArchive_t *archive)
+{
+    return (archive->header != NULL) ? archive->header->sweepCount : 0;
+}
+
+bool sweepArchiveGet(const MqsSweepArchive_t *archive, uint64_t n, MqsSweepView_t *view)
+{
+    if (archive->header == NULL || n >= archive->header->sweepCount)
+    {
+        return false;
+    }
+
+    const MqsArchiveIndexEntry_t *entry = &archive->index[n];
+    view->points = (MqsRawDataPoint_t *)(archive->base + entry->offset);
+    view->size = (int)entry->length;
+    view->sweepId = entry->sweepId;
+    view->timestamp = entry->timestamp;
+    return true;
+}
+
+void sweepArchiveClose(MqsSweepArchive_t *archive)
+{
+    if (archive->base != NULL)
+    {
+#if SWEEP_ARCHIVE_MMAP
+        munmap(archive->base, archive->mappedSize);
+#else
+        free(archive->base);
+#endif
+    }
+    memset(archive, 0, sizeof(*archive));
+}
+
+/*!
+ * @brief Writes zero bytes until the file offset is a multiple of the payload alignment.
+ */
+static bool padToAlignment(MqsSweepArchiveWriter_t *writer)
+{
+    static const uint8_t zeros[SWEEP_ARCHIVE_ALIGNMENT] = { 0 };
+    size_t padding = (size_t)((SWEEP_ARCHIVE_ALIGNMENT - writer->offset % SWEEP_ARCHIVE_ALIGNMENT) % SWEEP_ARCHIVE_ALIGNMENT);
+
+    if (padding > 0 && fwrite(zeros, 1, padding, writer->file) != padding)
+    {
+        return false;
+    }
+    writer->offset += padding;
+    return true;
+}
+
+bool sweepArchiveCreate(MqsSweepArchiveWriter_t *writer, const char *path)
+{
+    memset(writer, 0, sizeof(*writer));
+
+    if (!isLittleEndian())
+    {
+        printf("Sweep archives require a little-endian host.\n");
+        return false;
+    }
+
+    writer->file = fopen(path, "wb");
+    if (writer->file == NULL)
+    {
+        return false;
+    }
+
+    // Placeholder header, patched by sweepArchiveFinish
+    MqsArchiveHeader_t header = { 0 };
+    if (fwrite(&header, sizeof(header), 1, writer->file) != 1)
+    {
+        fclose(writer->file);
+        writer->file = NULL;
+        return false;
+    }
+    writer->offset = sizeof(header);
+    return true;
+}
+
+bool sweepArchiveAppend(MqsSweepArchiveWriter_t *writer, const MqsRawDataPoint_t points[], int size, uint64_t sweepId, int64_t timestamp)
+{
+    if (writer->file == NULL || size < 0)
+    {
+        return false;
+    }
+
+    if (writer->count == writer->capacity)
+    {
+        uint64_t capacity = (writer->capacity > 0) ? writer->capacity * 2 : 256;
+        MqsArchiveIndexEntry_t *index = realloc(writer->index, (size_t)capacity * sizeof(MqsArchiveIndexEntry_t));
+        if (index == NULL)
+        {
+            return false;
+        }
+        writer->index = index;
+        writer->capacity = capacity;
+    }
+
+    if (!padToAlignment(writer))
+    {
+        return false;
+    }
+
+    if ((size_t)size > 0 && fwrite(points, sizeof(MqsRawDataPoint_t), (size_t)size, writer->file) != (size_t)size)
+    {
+        return false;
+    }
+
+    MqsArchiveIndexEntry_t *entry = &writer->index[writer->count++];
+    memset(entry, 0, sizeof(*entry));
+    entry->offset = writer->offset;
+    entry->length = (uint32_t)size;
+    entry->sweepId = sweepId;
+    entry->timestamp = timestamp;
+
+    writer->offset += (uint64_t)size * sizeof(MqsRawDataPoint_t);
+    return true;
+}
+
+bool sweepArchiveFinish(MqsSweepArchiveWriter_t *writer)
+{
+    bool ok = writer->file != NULL && padToAlignment(writer);
+
+    MqsArchiveHeader_t header = { 0 };
+    header.magic = SWEEP_ARCHIVE_MAGIC;
+    header.version = SWEEP_ARCHIVE_VERSION;
+    header.headerSize = sizeof(MqsArchiveHeader_t);
+    header.pointSize = sizeof(MqsRawDataPoint_t);
+    header.alignment = SWEEP_ARCHIVE_ALIGNMENT;
+    header.sweepCount = writer->count;
+    header.indexOffset = writer->offset;
+
+    if (ok && writer->count > 0)
+    {
+        ok = fwrite(writer->index, sizeof(MqsArchiveIndexEntry_t), (size_t)writer->count, writer->file) == (size_t)writer->count;
+    }
+    if (ok)
+    {
+        ok = fseek(writer->file, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, writer->file) == 1;
+    }
+    if (writer->file != NULL && fclose(writer->file) != 0)
+    {
+        ok = false;
+    }
+
+    free(writer->index);
+    memset(writer, 0, sizeof(*writer));
+    return ok;
+}
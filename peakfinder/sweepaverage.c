@@ -0,0 +1,215 @@
+/*!
+ * Multi-Sweep Averaging
+ *
+ * Description:
+ * Accumulates repeated sweeps to raise the signal-to-noise ratio before detection. The
+ * running mean and the Welford variance are updated point by point in branch-free loops
+ * that the compiler vectorises; the robust modes keep every repeat and sort the repeats of
+ * each point when the estimate is requested. The accumulation can stop as soon as the
+ * detected peak no longer changes.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+#include <stdbool.h>
+#include "mes_sweepaverage.h"
+#include "mes_workspace.h"
+#include "mes_noalloc.h"
+
+size_t sweepAverageWorkspaceSize(int size, MqsAverageMode_t mode, int maxRepeats)
+{
+    size_t bytes = 3 * WORKSPACE_BYTES(size, float) + WORKSPACE_ALIGNMENT;
+
+    if (mode != MQS_AVERAGE_MEAN)
+    {
+        bytes += WORKSPACE_BYTES((size_t)size * maxRepeats, float) + WORKSPACE_BYTES(maxRepeats, float);
+    }
+    return bytes;
+}
+
+bool sweepAverageInit(MqsSweepAverage_t *average, int size, MqsAverageMode_t mode, float trimFraction, int maxRepeats, MqsWorkspace_t *workspace)
+{
+    size_t bytes = (size_t)size * sizeof(float);
+
+    *average = (MqsSweepAverage_t){ 0 };
+    average->size = size;
+    average->mode = mode;
+    average->trimFraction = trimFraction;
+    average->mean = workspaceAlloc(workspace, bytes);
+    average->m2 = workspaceAlloc(workspace, bytes);
+    average->impedance = workspaceAlloc(workspace, bytes);
+    if (average->mean == NULL || average->m2 == NULL || average->impedance == NULL)
+    {
+        return false;
+    }
+
+    if (mode != MQS_AVERAGE_MEAN)
+    {
+        average->capacity = maxRepeats;
+        average->history = workspaceAlloc(workspace, bytes * maxRepeats);
+        average->scratch = workspaceAlloc(workspace, (size_t)maxRepeats * sizeof(float));
+        if (average->history == NULL || average->scratch == NULL)
+        {
+            return false;
+        }
+    }
+
+    for (int i = 0; i < size; i++)
+    {
+        average->mean[i] = 0.0f;
+        average->m2[i] = 0.0f;
+        average->impedance[i] = 0.0f;
+    }
+    return true;
+}
+
+bool sweepAverageAdd(MqsSweepAverage_t *average, const MqsRawDataPoint_t sweep[])
+{
+    if (average->mode != MQS_AVERAGE_MEAN && average->count >= average->capacity)
+    {
+        return false;
+    }
+
+    int size = average->size;
+    float weight = 1.0f / (float)(average->count + 1);
+    float *restrict mean = average->mean;
+    float *restrict m2 = average->m2;
+    float *restrict impedance = average->impedance;
+
+    // Welford update, the same operations for every point
+    for (int i = 0; i < size; i++)
+    {
+        float x = sweep[i].phaseAngle;
+        float delta = x - mean[i];
+        mean[i] += delta * weight;
+        m2[i] += delta * (x - mean[i]);
+        impedance[i] += (sweep[i].impedance - impedance[i]) * weight;
+    }
+
+    if (average->history != NULL)
+    {
+        // Point-major, so the repeats of one point are contiguous when sorted
+        for (int i = 0; i < size; i++)
+        {
+            average->history[(size_t)i * average->capacity + average->count] = sweep[i].phaseAngle;
+        }
+    }
+
+    average->count++;
+    return true;
+}
+
+/*!
+ * @brief Sorts a few values in place; the number of repeats is small.
+ */
+static void insertionSort(float values[], int count)
+{
+    for (int i = 1; i < count; i++)
+    {
+        float value = values[i];
+        int j = i - 1;
+        while (j >= 0 && values[j] > value)
+        {
+            values[j + 1] = values[j];
+            j--;
+        }
+        values[j + 1] = value;
+    }
+}
+
+void sweepAverageEstimate(MqsSweepAverage_t *average, MqsRawDataPoint_t sweep[])
+{
+    int size = average->size;
+    int count = average->count;
+
+    for (int i = 0; i < size; i++)
+    {
+        sweep[i].phaseAngle = average->mean[i];
+        sweep[i].impedance = average->impedance[i];
+    }
+
+    if (average->mode == MQS_AVERAGE_MEAN || count == 0)
+    {
+        return;
+    }
+
+    int trim = (average->mode == MQS_AVERAGE_TRIMMED) ? (int)(average->trimFraction * count) : 0;
+    if (2 * trim >= count)
+    {
+        trim = (count - 1) / 2;
+    }
+
+    for (int i = 0; i < size; i++)
+    {
+        const float *repeats = &average->history[(size_t)i * average->capacity];
+        float *sorted = average->scratch;
+
+        for (int k = 0; k < count; k++)
+        {
+            sorted[k] = repeats[k];
+        }
+        insertionSort(sorted, count);
+
+        if (average->mode == MQS_AVERAGE_MEDIAN)
+        {
+            sweep[i].phaseAngle = (count % 2) ? sorted[count / 2] : 0.5f * (sorted[count / 2 - 1] + sorted[count / 2]);
+        }
+        else
+        {
+            float sum = 0.0f;
+            for (int k = trim; k < count - trim; k++)
+            {
+                sum += sorted[k];
+            }
+            sweep[i].phaseAngle = sum / (float)(count - 2 * trim);
+        }
+    }
+}
+
+void sweepAverageVariance(const MqsSweepAverage_t *average, float variance[])
+{
+    float scale = (average->count > 1) ? 1.0f / (float)(average->count - 1) : 0.0f;
+
+    for (int i = 0; i < average->size; i++)
+    {
+        variance[i] = average->m2[i] * scale;
+    }
+}
+
+size_t sweepAverageIsStableWorkspaceSize(int size, const MqsPeakConfig_t *config)
+{
+    return WORKSPACE_BYTES(size, MqsRawDataPoint_t) + processPeakWorkspaceSize(size, config) + WORKSPACE_ALIGNMENT;
+}
+
+bool sweepAverageIsStable(MqsSweepAverage_t *average, const MqsAverageStopCriteria_t *criteria,
+                          const MqsPeakConfig_t *config, MqsWorkspace_t *workspace)
+{
+    if (average->count < criteria->minSweeps)
+    {
+        return false;
+    }
+
+    size_t mark = workspaceMark(workspace);
+    MqsRawDataPoint_t *estimate = workspaceAlloc(workspace, (size_t)average->size * sizeof(MqsRawDataPoint_t));
+    if (estimate == NULL)
+    {
+        return false;
+    }
+
+    MqsPeakResult_t result;
+    sweepAverageEstimate(average, estimate);
+    bool accepted = processPeakDetailed(estimate, average->size, config, workspace, &result);
+    workspaceRelease(workspace, mark);
+
+    bool withinTolerance = accepted && average->lastProminence > 0.0f &&
+                           fabsf(result.prominence - average->lastProminence) <= criteria->prominenceTolerance * average->lastProminence &&
+                           fabsf(result.fwhmInterpolated - average->lastFwhm) <= criteria->fwhmTolerance;
+
+    average->stableCount = withinTolerance ? average->stableCount + 1 : 0;
+    average->lastProminence = accepted ? result.prominence : 0.0f;
+    average->lastFwhm = result.fwhmInterpolated;
+
+    return average->stableCount >= criteria->stableChecks;
+}
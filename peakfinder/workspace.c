@@ -0,0 +1,64 @@
+/*!
+ * Workspace Arena
+ *
+ * Description:
+ * Bump allocator over caller-owned memory, used by the entry points that need scratch
+ * tables so that the detection engine never allocates from the heap.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "mes_workspace.h"
+#include "mes_noalloc.h"
+
+void workspaceInit(MqsWorkspace_t *workspace, void *buffer, size_t capacity)
+{
+    workspace->base = buffer;
+    workspace->capacity = (buffer != NULL) ? capacity : 0;
+    workspace->used = 0;
+}
+
+void *workspaceAlloc(MqsWorkspace_t *workspace, size_t bytes)
+{
+    if (workspace == NULL)
+    {
+        return NULL;
+    }
+
+    // Align the address rather than the offset, the buffer itself may be unaligned
+    uintptr_t address = (uintptr_t)(workspace->base + workspace->used);
+    size_t padding = (size_t)((WORKSPACE_ALIGNMENT - address % WORKSPACE_ALIGNMENT) % WORKSPACE_ALIGNMENT);
+    size_t rounded = (bytes + WORKSPACE_ALIGNMENT - 1) / WORKSPACE_ALIGNMENT * WORKSPACE_ALIGNMENT;
+
+    if (padding > workspace->capacity - workspace->used ||
+        rounded > workspace->capacity - workspace->used - padding)
+    {
+        return NULL;
+    }
+
+    void *block = workspace->base + workspace->used + padding;
+    workspace->used += padding + rounded;
+    return block;
+}
+
+size_t workspaceMark(const MqsWorkspace_t *workspace)
+{
+    return (workspace != NULL) ? workspace->used : 0;
+}
+
+void workspaceRelease(MqsWorkspace_t *workspace, size_t mark)
+{
+    if (workspace != NULL && mark <= workspace->used)
+    {
+        workspace->used = mark;
+    }
+}
+
+void *workspaceForbiddenAlloc(const char *file, int line)
+{
+    fprintf(stderr, "Heap allocation in the detection engine at %s:%d\n", file, line);
+    abort();
+    return NULL;
+}